@@ -19,10 +19,13 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <Polygon4/DataManager/String.h>
 #include <Polygon4/DataManager/Types.h>
+#include <Polygon4/ScreenTextBuffer.h>
+#include <Polygon4/TextTemplate.h>
 
 namespace polygon4
 {
@@ -31,6 +34,68 @@ using FunctionName = String;
 using ScriptParameters = std::vector<String>;
 using ScriptCallback = std::function<void(const FunctionName &, const ScriptParameters &)>;
 
+struct InfoTreeItem;
+class InfoTreePool;
+
+// non-owning handle to a tree node
+// children were shared_ptrs before, the handle keeps that interface for the ui
+class InfoTreeItemPtr
+{
+public:
+    InfoTreeItemPtr(InfoTreeItem *p = nullptr) : p(p) {}
+
+    InfoTreeItem *get() const { return p; }
+    InfoTreeItem *operator->() const { return p; }
+    InfoTreeItem &operator*() const { return *p; }
+    explicit operator bool() const { return p != nullptr; }
+
+    bool operator==(const InfoTreeItemPtr &rhs) const { return p == rhs.p; }
+    bool operator!=(const InfoTreeItemPtr &rhs) const { return p != rhs.p; }
+
+private:
+    InfoTreeItem *p;
+};
+
+// children of a tree node
+// nodes live in the pool of their tree, see InfoTreeItem::addChild()
+class P4_ENGINE_API InfoTreeChildren
+{
+    using Items = std::vector<InfoTreeItemPtr>;
+
+public:
+    using value_type = InfoTreeItemPtr;
+    using iterator = Items::iterator;
+    using const_iterator = Items::const_iterator;
+
+    InfoTreeChildren(InfoTreeItem &owner) : owner(owner) {}
+
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    const InfoTreeItemPtr &operator[](size_t i) const { return items[i]; }
+
+    // non-const iterators allow reordering, e.g. std::sort()
+    iterator begin() { return items.begin(); }
+    iterator end() { return items.end(); }
+    const_iterator begin() const { return items.begin(); }
+    const_iterator end() const { return items.end(); }
+
+    // nodes go back to the pool and are reused by the next refresh
+    void clear();
+
+    // first child with this object
+    InfoTreeItem *find(const detail::IObjectBase *o) const;
+
+private:
+    InfoTreeItem &owner;
+    Items items;
+    // built on demand for long lists
+    mutable std::unordered_map<const detail::IObjectBase *, InfoTreeItem *> index;
+    mutable bool index_valid = false;
+
+    friend struct InfoTreeItem;
+    friend class InfoTreePool;
+};
+
 struct P4_ENGINE_API InfoTreeItem
 {
     enum
@@ -72,7 +137,7 @@ struct P4_ENGINE_API InfoTreeItem
     };
 
     InfoTreeItem *parent = nullptr;
-    std::vector<std::shared_ptr<InfoTreeItem>> children;
+    InfoTreeChildren children{ *this };
 
     String text;
     detail::IObjectBase *object = nullptr;
@@ -81,23 +146,52 @@ struct P4_ENGINE_API InfoTreeItem
     bool hidden_if_empty = false;
 
     InfoTreeItem(const detail::IObjectBase *o = nullptr);
+    InfoTreeItem(const InfoTreeItem &) = delete;
+    InfoTreeItem &operator=(const InfoTreeItem &) = delete;
+    ~InfoTreeItem();
 
+    // takes a node from the pool of the tree, roots create the pool on first use
+    InfoTreeItem *addChild(const detail::IObjectBase *o = nullptr);
     InfoTreeItem *findChild(const detail::IObjectBase *o);
 
     InfoTreeItem &operator=(const detail::IObjectBase *o);
 
 private:
+    InfoTreePool *pool = nullptr;
+    std::unique_ptr<InfoTreePool> own_pool;
+
     void assign(const detail::IObjectBase *o);
+    void reset();
+    InfoTreePool &getPool();
+
+    friend class InfoTreeChildren;
+    friend class InfoTreePool;
 };
 
 class P4_ENGINE_API BuildingMenu
 {
+public:
+    // trees rebuilt by update()
+    enum Section
+    {
+        SectionThemes       = 1 << 0,
+        SectionJournal      = 1 << 1,
+        SectionGlider       = 1 << 2,
+        SectionGliderStore  = 1 << 3,
+        SectionHoldStore    = 1 << 4,
+        SectionGoodsStore   = 1 << 5,
+
+        SectionAll          = (1 << 6) - 1,
+    };
+
 public:
     BuildingMenu();
     virtual ~BuildingMenu();
 
-    const String &getText() const { return text; }
-    String &getText() { return text; }
+    // whole text, the ui should prefer getTextBuffer().getDelta()
+    const String &getText() const { return text.str(); }
+    ScreenTextBuffer &getTextBuffer() { return text; }
+    const ScreenTextBuffer &getTextBuffer() const { return text; }
 
     void setCurrentBuilding(detail::ModificationMapBuilding *b);
     void setCurrentMechanoid(detail::Mechanoid *m);
@@ -127,7 +221,16 @@ public:
     void addThemeMessage(const String &obj);
     bool checkAndAddThemeObject(const detail::IObjectBase *o);
 
+    // rebuilds sections changed since the previous call
+    // configuration item changes are detected by its revision, other changes mark
+    // sections through invalidate()
     void update();
+    // e.g. after trade changed the building inventory
+    void invalidate(int sections = SectionAll) { dirty |= sections; }
+    // sections rebuilt by the last update(), the ui re-renders only them
+    int getChangedSections() const { return changed; }
+    bool isChanged(Section s) const { return (changed & s) != 0; }
+
     void updateThemes();
     void updateGlider();
     void updateGliderStore();
@@ -158,16 +261,33 @@ protected:
     InfoTreeItem clans;
 
 private:
-    String text;
-    String mainScreenText;
+    ScreenTextBuffer text;
+    ScreenTextBuffer mainScreenText;
 
     String currentQuest;
 
+    int dirty = SectionAll;
+    int changed = 0;
+    // glider and hold trees were built from this configuration state
+    const detail::Configuration *builtConfiguration = nullptr;
+    uint64_t builtRevision = 0;
+
     // remove and rely on themes?
     std::vector<const detail::IObjectBase *> showedObjects;
 
+    struct CompiledText
+    {
+        String source;
+        TextTemplate text;
+    };
+    // message texts are compiled once
+    std::unordered_map<const detail::Message *, CompiledText> messageTemplates;
+    TextTemplate scratchTemplate;
+    String printBuffer;
+
     void printMessage(const detail::Message *msg);
-    void printText(String text);
+    void printText(const String &text);
+    void printTemplate(const TextTemplate &t);
     void printTitle(const String &t);
 };
 
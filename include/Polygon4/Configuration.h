@@ -19,8 +19,10 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <set>
+#include <vector>
 
 #include <Polygon4/DataManager/Types.h>
 
@@ -29,6 +31,19 @@ namespace polygon4
 
 class Mechanoid;
 
+// compact copy of hot item fields
+// storage objects remain the source of truth
+struct ItemStats
+{
+    detail::EquipmentType type{};
+    float power = 0.0f;
+    float value1 = 0.0f;
+    float value2 = 0.0f;
+    float value3 = 0.0f;
+    float weight = 0.0f;
+    float firerate = 0.0f;
+};
+
 class P4_ENGINE_API Configuration : public detail::Configuration
 {
     using Base = detail::Configuration;
@@ -67,8 +82,27 @@ public:
 
     virtual void tick(float delta_seconds) override final;
 
+    const std::vector<ItemStats> &getEquipmentStats() const;
+
+    // changes on every item change, views compare it with the value they were built from
+    uint64_t getRevision() const { return revision; }
+
 private:
     Mechanoid *mechanoid = nullptr;
+
+    // cached stats are rebuilt lazily after any item change
+    mutable std::vector<ItemStats> equipment_stats;
+    mutable float items_mass = 0.0f;
+    mutable bool stats_dirty = true;
+    uint64_t revision = 0;
+
+    // called by every item change
+    void invalidateStats()
+    {
+        stats_dirty = true;
+        revision++;
+    }
+    void updateStats() const;
 };
 
 } // namespace polygon4
@@ -24,6 +24,8 @@
 
 #include <Polygon4/DataManager/Types.h>
 
+#include <Polygon4/Configuration.h>
+
 namespace polygon4
 {
 
@@ -38,6 +40,11 @@ public:
     virtual bool shoot() override final;
 
 private:
+    // copy of weapon stats, refreshed when the weapon is replaced
+    ItemStats stats;
+    const detail::Weapon *stats_weapon = nullptr;
+
+    const ItemStats &getStats();
 };
 
 } // namespace polygon4
@@ -29,6 +29,8 @@
 
 #include <Polygon4/DataManager/Settings.h>
 
+#include <Polygon4/EngineSettings.h>
+
 #define DECLARE_MENU_VIRTUAL(name)       \
 public:                                  \
     virtual void Show##name##Menu() = 0; \
@@ -100,6 +102,9 @@ public:
     Settings &getSettings();
     const Settings &getSettings() const;
 
+    EngineSettings &getEngineSettings() { return engineSettings; }
+    const EngineSettings &getEngineSettings() const { return engineSettings; }
+
     SavedGames getSavedGames(bool save = false) const;
     bool save(const String &fn) const;
     bool saveAuto() const;
@@ -107,6 +112,13 @@ public:
     bool load(const String &fn);
     void deleteSaveGame(const String &fn) const;
 
+    // script call traces of the current modification, written to <mod>/Traces
+    // the game is saved into <saves>/Traces first, user saves are not touched
+    bool startScriptTrace(const String &name);
+    void stopScriptTrace();
+    // loads the snapshot save of the trace file and replays its calls, results are logged
+    bool replayScriptTrace(const String &fn);
+
     virtual Storage* getStorage() const override final { return storage.get(); }
 
     virtual Modification* getCurrentModification() const override final { return currentModification; }
@@ -126,6 +138,7 @@ protected:
 private:
     // temp settings
     Settings settings;
+    EngineSettings engineSettings;
 
     mutable std::mutex m_save;
 
@@ -163,6 +176,7 @@ Engine *getEngine(Engine *engine = nullptr);
 // useful macros used across the engine
 #define GET_STORAGE() ::polygon4::getEngine()->getStorage()
 #define GET_SETTINGS() ::polygon4::getEngine()->getSettings()
+#define GET_ENGINE_SETTINGS() ::polygon4::getEngine()->getEngineSettings()
 
 #define GET_BUILDING_MENU() ::polygon4::getEngine()->getBuildingMenu()
 
@@ -0,0 +1,74 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace polygon4
+{
+
+// runtime engine settings
+// unlike Settings they are not stored in the database
+struct EngineSettings
+{
+    struct Streaming
+    {
+        // spawn map objects around the player instead of all at once
+        bool enabled = false;
+        // objects closer than this are spawned
+        float spawn_radius = 50000.0f;
+        // objects farther than this are despawned
+        // must be greater than spawn_radius to avoid spawn/despawn flicker
+        float despawn_radius = 60000.0f;
+        // max objects spawned per update
+        int spawn_budget = 16;
+        // player must move this far before despawn candidates are rechecked
+        float update_distance = 1000.0f;
+    } streaming;
+
+    struct Scripts
+    {
+        // keep compiled lua chunks in <mod>/Cache/Bytecode
+        bool bytecode_cache = true;
+        // hard limit for the lua vm in bytes, 0 - unlimited
+        size_t memory_limit = 0;
+        // collect lua profile, it is written to <mod>/Profiles when disabled
+        // P4_LUA_PROFILE env var enables it at startup
+        bool profile = false;
+        // instructions between stack samples
+        int profile_sample_interval = 1000;
+        // limits for a single script call, 0 - unlimited
+        // calls over the limit are aborted with a lua error
+        uint64_t instruction_budget = 0;
+        int time_budget_ms = 0;
+        // reload changed scripts in ScriptEngine::update()
+        // without it every getScript() checks file times of the script
+        bool hot_reload = true;
+        // used where inotify is not available
+        int hot_reload_poll_ms = 1000;
+        // worker threads for bot building scripts, 0 - bots do not run scripts
+        int bot_threads = 2;
+        // luajit builds only, false runs scripts in the interpreter
+        // applied when a modification creates its script engine
+        bool jit = true;
+    } scripts;
+};
+
+} // namespace polygon4
@@ -18,8 +18,12 @@
 
 #pragma once
 
+#include <functional>
+
 #include <Polygon4/DataManager/Types.h>
 
+#include <Polygon4/ObjectStreamer.h>
+
 namespace polygon4
 {
 
@@ -31,6 +35,19 @@ public:
     Map(const Base &);
 
     virtual bool loadObjects() override final;
+
+    // distance based streaming
+    // Modification::update() calls it every frame with the player position
+    void updateStreaming(float x, float y);
+    bool isStreaming() const { return streaming; }
+    const ObjectStreamer<detail::IObjectBase> &getStreamer() const { return streamer; }
+
+    // set on the game side, returns true if the object was removed from the world
+    std::function<bool(detail::IObjectBase *)> DespawnObject;
+
+private:
+    bool streaming = false;
+    ObjectStreamer<detail::IObjectBase> streamer;
 };
 
 } // namespace polygon4
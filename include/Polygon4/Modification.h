@@ -18,11 +18,45 @@
 
 #pragma once
 
+#include <atomic>
+#include <future>
+#include <unordered_map>
+#include <vector>
+
 #include <Polygon4/DataManager/Types.h>
 
+#include <Polygon4/SpatialIndex.h>
+
 namespace polygon4
 {
 
+// objects of the modification that belong to a single map
+// built from the modification data when a game starts,
+// the engine never moves mechanoids or players between maps while the game runs
+struct MapIndex
+{
+    detail::ModificationMap *map = nullptr;
+    std::vector<detail::Mechanoid *> mechanoids;
+    std::vector<detail::ModificationMapBuilding *> buildings;
+
+    SpatialIndex<detail::ModificationMapBuilding> building_positions;
+    SpatialIndex<detail::Mechanoid> mechanoid_positions;
+};
+
+enum class LoadingStage
+{
+    None,
+
+    // worker thread
+    Index,
+    Scripts,
+
+    // game thread
+    GameThread,
+
+    Failed,
+};
+
 class P4_ENGINE_API Modification : public detail::Modification
 {
     using Base = detail::Modification;
@@ -32,6 +66,20 @@ public:
     ~Modification();
 
     virtual bool newGame() override final;
+
+    // staged loading, cpu only stages are run on a worker
+    // call updateLoading() every frame on the game thread until it returns true,
+    // then check getLoadingStage(), it is LoadingStage::Failed if the game was not started
+    bool newGameAsync();
+    bool updateLoading();
+    bool isLoading() const;
+    LoadingStage getLoadingStage() const { return loadingStage; }
+    float getLoadingProgress() const { return loadingProgress; }
+    // call every frame on the game thread while the game is running
+    // fires script timers, resumes waiting scripts on playtime,
+    // moves mechanoids of the current map in the spatial index
+    // and streams map objects around the local player
+    void update();
     virtual bool loadGame(const String &filename) override final;
 
     virtual void spawnMechanoids() override final;
@@ -41,10 +89,31 @@ public:
 
     bool operator<(const Modification &rhs) const;
 
+    // per-map index
+    void buildMapIndex();
+    const MapIndex *getMapIndex(const detail::Map *map) const;
+
 protected:
     detail::Map *currentMap = nullptr;
     detail::ModificationPlayer *currentPlayer = nullptr;
     std::unique_ptr<ScriptEngine> scriptEngine;
+    std::unordered_map<const detail::Map *, MapIndex> mapIndex;
+
+private:
+    std::atomic<LoadingStage> loadingStage{ LoadingStage::None };
+    std::atomic<float> loadingProgress{ 0.0f };
+    // set when the worker stages are done
+    std::future<void> loader;
+    // built by the worker, moved to scriptEngine on the game thread
+    std::unique_ptr<ScriptEngine> loadedScriptEngine;
+
+    detail::ModificationPlayer *findLocalPlayer() const;
+    void updateMechanoidPositions();
+    void updateStreaming();
+
+    bool prepareNewGame();
+    void runLoadingStages();
+    bool finishNewGame();
 };
 
 } // namespace polygon4
@@ -0,0 +1,150 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <Polygon4/EngineSettings.h>
+#include <Polygon4/SpatialIndex.h>
+
+namespace polygon4
+{
+
+// distance based spawning of static objects around the player
+// objects are spawned nearest first, at most spawn_budget per update(),
+// and despawned when they are farther than despawn_radius
+template <class T>
+class ObjectStreamer
+{
+public:
+    using Settings = EngineSettings::Streaming;
+
+    // set by the owner, Despawn returns true if the object was removed from the world
+    std::function<void(T *)> Spawn;
+    std::function<bool(T *)> Despawn;
+
+    void reset(float cell_size)
+    {
+        items.clear();
+        spawned.clear();
+        index = SpatialIndex<Item>(cell_size);
+        hasLastPosition = false;
+        pending = false;
+    }
+
+    void add(T *o, float x, float y)
+    {
+        items.push_back({ o, x, y });
+        index.insert(&items.back(), x, y);
+    }
+
+    size_t size() const { return items.size(); }
+    size_t spawnedCount() const { return spawned.size(); }
+    // objects inside spawn_radius are still waiting for the budget
+    bool isPending() const { return pending; }
+
+    bool isSpawned(const T *o) const
+    {
+        return std::any_of(spawned.begin(), spawned.end(), [o](auto i) { return i->object == o; });
+    }
+
+    // call every frame with the player position
+    void update(float x, float y, const Settings &ss)
+    {
+        bool moved = true;
+        if (hasLastPosition)
+        {
+            auto dx = x - lastX;
+            auto dy = y - lastY;
+            moved = dx * dx + dy * dy >= ss.update_distance * ss.update_distance;
+        }
+        if (moved)
+        {
+            lastX = x;
+            lastY = y;
+            hasLastPosition = true;
+        }
+
+        // spawn nearest objects first, limited by the budget
+        if (moved || pending)
+        {
+            candidates.clear();
+            index.queryRadius(x, y, ss.spawn_radius, [this](const auto &e, float d2)
+            {
+                if (!e.object->spawned)
+                    candidates.emplace_back(d2, e.object);
+            });
+            auto n = std::min(candidates.size(), (size_t)std::max(ss.spawn_budget, 0));
+            std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(),
+                [](const auto &a, const auto &b) { return a.first < b.first; });
+            for (size_t i = 0; i < n; i++)
+                spawn(*candidates[i].second);
+            pending = candidates.size() > n;
+        }
+
+        // despawn far objects
+        if (!moved || !Despawn)
+            return;
+        auto r2 = ss.despawn_radius * ss.despawn_radius;
+        auto i = std::remove_if(spawned.begin(), spawned.end(), [this, x, y, r2](auto o)
+        {
+            auto dx = o->x - x;
+            auto dy = o->y - y;
+            if (dx * dx + dy * dy <= r2)
+                return false;
+            if (!Despawn(o->object))
+                return false;
+            o->spawned = false;
+            return true;
+        });
+        spawned.erase(i, spawned.end());
+    }
+
+private:
+    struct Item
+    {
+        T *object = nullptr;
+        float x = 0.0f;
+        float y = 0.0f;
+        bool spawned = false;
+    };
+
+    // deque keeps items in place for the index
+    std::deque<Item> items;
+    std::vector<Item *> spawned;
+    std::vector<std::pair<float, Item *>> candidates;
+    SpatialIndex<Item> index;
+    float lastX = 0.0f;
+    float lastY = 0.0f;
+    bool hasLastPosition = false;
+    bool pending = false;
+
+    void spawn(Item &o)
+    {
+        if (Spawn)
+            Spawn(o.object);
+        o.spawned = true;
+        spawned.push_back(&o);
+    }
+};
+
+} // namespace polygon4
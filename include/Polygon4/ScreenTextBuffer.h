@@ -0,0 +1,100 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include <Polygon4/DataManager/String.h>
+
+namespace polygon4
+{
+
+// screen text kept as appended segments
+// text only grows at the end or is cleared, so any older state of the text is
+// a prefix of segments plus removed ones, and the ui can be synced with a delta:
+//     auto d = buffer.getDelta(version);
+//     ui_text.resize(d.keep);
+//     ui_text += d.appended;
+//     version = d.version;
+// segments of a cleared text are reused when the same texts are appended again,
+// so re-rendering unchanged text produces an empty delta
+class P4_ENGINE_API ScreenTextBuffer
+{
+public:
+    struct Delta
+    {
+        uint64_t version = 0;
+        // characters of the old text that are still valid
+        size_t keep = 0;
+        String appended;
+    };
+
+public:
+    void append(const String &s);
+    // decodes utf-8 without temporary strings, used by script bindings
+    void appendUtf8(std::string_view s);
+    ScreenTextBuffer &operator+=(const String &s) { append(s); return *this; }
+    void clear();
+    // keeps the segments of other, e.g. to restore saved text
+    void assign(const ScreenTextBuffer &other);
+
+    bool empty() const { return visible == 0; }
+    size_t size() const;
+    bool endsWith(const String &s) const;
+
+    // whole text, joined on demand
+    const String &str() const;
+
+    // changes on every change of the text
+    uint64_t getVersion() const { return version; }
+    // changes since the text of the given version, 0 - the whole text
+    Delta getDelta(uint64_t since) const;
+
+private:
+    struct Segment
+    {
+        String text;
+        // in characters
+        size_t offset;
+        // version that added the segment
+        uint64_t version;
+    };
+
+    std::vector<Segment> segments;
+    // segments after this one are removed, but may be reused by append()
+    size_t visible = 0;
+    uint64_t version = 0;
+    uint64_t cleared = 0;
+    // last version read by the ui
+    mutable uint64_t observed = 0;
+
+    // reused by appendUtf8()
+    String decoded;
+
+    mutable String joined;
+    mutable size_t joined_count = 0;
+
+    const String &join() const;
+    void dropRemoved();
+};
+
+} // namespace polygon4
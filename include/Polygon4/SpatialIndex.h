@@ -0,0 +1,348 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace polygon4
+{
+
+// uniform grid over map (x, y) coordinates
+// objects are stored in hashed cells, so only occupied cells cost memory
+template <class T>
+class SpatialIndex
+{
+public:
+    struct Entry
+    {
+        T *object = nullptr;
+        float x = 0.0f;
+        float y = 0.0f;
+    };
+
+    SpatialIndex(float cell_size = 10000.0f)
+        : cell_size(cell_size > 0 ? cell_size : 1.0f)
+    {
+    }
+
+    void clear()
+    {
+        cells.clear();
+        positions.clear();
+    }
+
+    size_t size() const { return positions.size(); }
+    bool empty() const { return positions.empty(); }
+    float getCellSize() const { return cell_size; }
+
+    void insert(T *o, float x, float y)
+    {
+        if (!o)
+            return;
+        if (positions.count(o))
+        {
+            update(o, x, y);
+            return;
+        }
+        auto key = cellKey(x, y);
+        cells[key].push_back({ o, x, y });
+        positions[o] = { key, x, y };
+    }
+
+    // incremental update for moving objects
+    // returns false if the object is not in the index
+    bool update(T *o, float x, float y)
+    {
+        auto i = positions.find(o);
+        if (i == positions.end())
+            return false;
+        auto key = cellKey(x, y);
+        auto &p = i->second;
+        if (key == p.key)
+        {
+            auto &c = cells[key];
+            auto e = std::find_if(c.begin(), c.end(), [o](const auto &e) { return e.object == o; });
+            e->x = x;
+            e->y = y;
+        }
+        else
+        {
+            eraseFromCell(p.key, o);
+            cells[key].push_back({ o, x, y });
+            p.key = key;
+        }
+        p.x = x;
+        p.y = y;
+        return true;
+    }
+
+    bool remove(T *o)
+    {
+        auto i = positions.find(o);
+        if (i == positions.end())
+            return false;
+        eraseFromCell(i->second.key, o);
+        positions.erase(i);
+        return true;
+    }
+
+    bool getPosition(const T *o, float &x, float &y) const
+    {
+        auto i = positions.find(const_cast<T *>(o));
+        if (i == positions.end())
+            return false;
+        x = i->second.x;
+        y = i->second.y;
+        return true;
+    }
+
+    // calls f(const Entry &) for every object inside the box
+    template <class F>
+    void queryBox(float min_x, float min_y, float max_x, float max_y, F &&f) const
+    {
+        auto cx1 = cellCoord(min_x);
+        auto cy1 = cellCoord(min_y);
+        auto cx2 = cellCoord(max_x);
+        auto cy2 = cellCoord(max_y);
+        auto in_box = [&](const auto &e)
+        {
+            return e.x >= min_x && e.x <= max_x && e.y >= min_y && e.y <= max_y;
+        };
+
+        // box covers more cells than are occupied
+        if ((double)(cx2 - cx1 + 1) * (cy2 - cy1 + 1) > cells.size())
+        {
+            for (auto &[_, c] : cells)
+            {
+                for (auto &e : c)
+                {
+                    if (in_box(e))
+                        f(e);
+                }
+            }
+            return;
+        }
+
+        for (auto cx = cx1; cx <= cx2; cx++)
+        {
+            for (auto cy = cy1; cy <= cy2; cy++)
+            {
+                auto c = cells.find(makeKey(cx, cy));
+                if (c == cells.end())
+                    continue;
+                for (auto &e : c->second)
+                {
+                    if (in_box(e))
+                        f(e);
+                }
+            }
+        }
+    }
+
+    std::vector<T *> queryBox(float min_x, float min_y, float max_x, float max_y) const
+    {
+        std::vector<T *> v;
+        queryBox(min_x, min_y, max_x, max_y, [&v](const auto &e) { v.push_back(e.object); });
+        return v;
+    }
+
+    // calls f(const Entry &, float distance2) for every object inside the circle
+    template <class F>
+    void queryRadius(float x, float y, float r, F &&f) const
+    {
+        auto r2 = r * r;
+        queryBox(x - r, y - r, x + r, y + r, [x, y, r2, &f](const auto &e)
+        {
+            auto d2 = distance2(e, x, y);
+            if (d2 <= r2)
+                f(e, d2);
+        });
+    }
+
+    std::vector<T *> queryRadius(float x, float y, float r) const
+    {
+        std::vector<T *> v;
+        queryRadius(x, y, r, [&v](const auto &e, float) { v.push_back(e.object); });
+        return v;
+    }
+
+    // k nearest objects ordered by distance
+    std::vector<T *> queryNearest(float x, float y, size_t k,
+        float max_radius = std::numeric_limits<float>::max()) const
+    {
+        std::vector<std::pair<float, T *>> found;
+        if (k == 0 || empty())
+            return {};
+
+        auto max_r2 = max_radius < std::sqrt(std::numeric_limits<float>::max())
+            ? max_radius * max_radius : std::numeric_limits<float>::max();
+        auto cx = cellCoord(x);
+        auto cy = cellCoord(y);
+
+        // walk square rings of cells around the query point
+        // stop when the ring is farther than the k-th candidate
+        for (int64_t ring = 0;; ring++)
+        {
+            // sparse index, faster to check every occupied cell
+            if (ring > 0 && (double)(2 * ring + 1) * (2 * ring + 1) > cells.size())
+            {
+                found.clear();
+                for (auto &[_, c] : cells)
+                {
+                    for (auto &e : c)
+                    {
+                        auto d2 = distance2(e, x, y);
+                        if (d2 <= max_r2)
+                            found.emplace_back(d2, e.object);
+                    }
+                }
+                break;
+            }
+
+            visitRing(cx, cy, ring, [&](const auto &e)
+            {
+                auto d2 = distance2(e, x, y);
+                if (d2 <= max_r2)
+                    found.emplace_back(d2, e.object);
+            });
+
+            if (found.size() == positions.size())
+                break;
+
+            // minimal distance from the point to the next ring
+            auto next = ring * cell_size + std::min(
+                std::min(x - cx * cell_size, (cx + 1) * cell_size - x),
+                std::min(y - cy * cell_size, (cy + 1) * cell_size - y));
+            auto next2 = next * next;
+            if (next2 > max_r2)
+                break;
+            if (found.size() >= k)
+            {
+                std::nth_element(found.begin(), found.begin() + (k - 1), found.end(),
+                    [](const auto &a, const auto &b) { return a.first < b.first; });
+                if (found[k - 1].first <= next2)
+                    break;
+            }
+        }
+
+        auto n = std::min(k, found.size());
+        std::partial_sort(found.begin(), found.begin() + n, found.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+        std::vector<T *> v;
+        v.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            v.push_back(found[i].second);
+        return v;
+    }
+
+    T *queryNearest(float x, float y) const
+    {
+        auto v = queryNearest(x, y, 1);
+        return v.empty() ? nullptr : v[0];
+    }
+
+private:
+    using Key = uint64_t;
+
+    struct Position
+    {
+        Key key;
+        float x;
+        float y;
+    };
+
+    float cell_size;
+    std::unordered_map<Key, std::vector<Entry>> cells;
+    std::unordered_map<T *, Position> positions;
+
+    static float distance2(const Entry &e, float x, float y)
+    {
+        auto dx = e.x - x;
+        auto dy = e.y - y;
+        return dx * dx + dy * dy;
+    }
+
+    int64_t cellCoord(float v) const
+    {
+        return (int64_t)std::floor(v / cell_size);
+    }
+
+    static Key makeKey(int64_t cx, int64_t cy)
+    {
+        return ((Key)(uint32_t)(int32_t)cx << 32) | (Key)(uint32_t)(int32_t)cy;
+    }
+
+    Key cellKey(float x, float y) const
+    {
+        return makeKey(cellCoord(x), cellCoord(y));
+    }
+
+    void eraseFromCell(Key key, T *o)
+    {
+        auto c = cells.find(key);
+        if (c == cells.end())
+            return;
+        auto &v = c->second;
+        auto e = std::find_if(v.begin(), v.end(), [o](const auto &e) { return e.object == o; });
+        if (e != v.end())
+        {
+            *e = v.back();
+            v.pop_back();
+        }
+        if (v.empty())
+            cells.erase(c);
+    }
+
+    template <class F>
+    void visitCell(int64_t cx, int64_t cy, F &&f) const
+    {
+        auto c = cells.find(makeKey(cx, cy));
+        if (c == cells.end())
+            return;
+        for (auto &e : c->second)
+            f(e);
+    }
+
+    template <class F>
+    void visitRing(int64_t cx, int64_t cy, int64_t ring, F &&f) const
+    {
+        if (ring == 0)
+        {
+            visitCell(cx, cy, f);
+            return;
+        }
+        for (auto i = -ring; i <= ring; i++)
+        {
+            visitCell(cx + i, cy - ring, f);
+            visitCell(cx + i, cy + ring, f);
+        }
+        for (auto i = -ring + 1; i <= ring - 1; i++)
+        {
+            visitCell(cx - ring, cy + i, f);
+            visitCell(cx + ring, cy + i, f);
+        }
+    }
+};
+
+} // namespace polygon4
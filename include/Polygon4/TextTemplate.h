@@ -0,0 +1,79 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <span>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include <Polygon4/DataManager/String.h>
+
+namespace polygon4
+{
+
+// text compiled once into literal runs and placeholder slots
+// constant tokens are folded into literals at compile time, slots are
+// filled by the caller on every expansion
+class P4_ENGINE_API TextTemplate
+{
+public:
+    struct Token
+    {
+        std::wstring_view pattern;
+        // replacement of constant tokens
+        std::wstring_view text;
+        // >= 0 - slot number passed to expand(), -1 - constant token
+        int slot = -1;
+    };
+
+public:
+    // trims trailing whitespace and replaces tokens in one pass
+    // at a position tokens are tried in the given order
+    void compile(const String &source, std::span<const Token> tokens);
+
+    // appends the text to out, value(slot, out) appends slot values
+    template <class F>
+    void expand(String &out, F &&value) const
+    {
+        for (auto &s : segments)
+        {
+            out.append(literals.data() + s.offset, s.length);
+            if (s.slot >= 0)
+                value(s.slot, out);
+        }
+    }
+
+    bool empty() const { return segments.empty(); }
+
+private:
+    // literal run followed by a slot
+    struct Segment
+    {
+        uint32_t offset;
+        uint32_t length;
+        int slot;
+    };
+
+    String literals;
+    std::vector<Segment> segments;
+};
+
+} // namespace polygon4
@@ -19,9 +19,11 @@
 #include <Polygon4/BuildingMenu.h>
 
 #include <algorithm>
+#include <deque>
 
 #include <boost/algorithm/string.hpp>
 
+#include <Polygon4/Configuration.h>
 #include <Polygon4/Engine.h>
 
 #define SMALL_DELIMETER "\n"
@@ -33,18 +35,132 @@
 namespace polygon4
 {
 
+enum TextSlot
+{
+    SlotName,
+    SlotBuildingName,
+    SlotBuildingRef,
+    SlotRatingName,
+    SlotOrgMember,
+    SlotQuest,
+};
+
+// replaced in every printed text
+static const TextTemplate::Token text_tokens[] =
+{
+    { L"<icon:POINT>", L"" BIG_SPACE },
+    { L"<p>", L"" SMALL_DELIMETER BIG_SPACE },
+    { L"%NAME", {}, SlotName },
+    { L"%BUILDINGNAME", {}, SlotBuildingName },
+    { L"%BUILDINGREF", {}, SlotBuildingRef },
+    { L"%RATINGNAME", {}, SlotRatingName },
+    { L"%ORGMEMBER", {}, SlotOrgMember },
+    { L"%QUEST", {}, SlotQuest },
+};
+
+// nodes of one tree
+// deque keeps node addresses stable, released nodes are reused before new ones are made
+class InfoTreePool
+{
+public:
+    InfoTreeItem *allocate(InfoTreeItem *parent)
+    {
+        InfoTreeItem *i;
+        if (!free.empty())
+        {
+            i = free.back();
+            free.pop_back();
+        }
+        else
+            i = &nodes.emplace_back();
+        i->parent = parent;
+        i->pool = this;
+        return i;
+    }
+
+    void release(InfoTreeItem *i)
+    {
+        for (auto &c : i->children.items)
+            release(c.get());
+        i->children.items.clear();
+        i->children.index.clear();
+        i->children.index_valid = false;
+        i->reset();
+        free.push_back(i);
+    }
+
+private:
+    std::deque<InfoTreeItem> nodes;
+    std::vector<InfoTreeItem *> free;
+};
+
+void InfoTreeChildren::clear()
+{
+    if (items.empty())
+        return;
+    auto &pool = owner.getPool();
+    for (auto &c : items)
+        pool.release(c.get());
+    items.clear();
+    index.clear();
+    index_valid = false;
+}
+
+InfoTreeItem *InfoTreeChildren::find(const detail::IObjectBase *o) const
+{
+    // short lists are faster to scan
+    if (items.size() < 16)
+    {
+        for (auto &c : items)
+        {
+            if (c->object == o)
+                return c.get();
+        }
+        return nullptr;
+    }
+
+    if (!index_valid)
+    {
+        index.clear();
+        for (auto &c : items)
+            index.emplace(c->object, c.get());
+        index_valid = true;
+    }
+    auto i = index.find(o);
+    return i != index.end() ? i->second : nullptr;
+}
+
 InfoTreeItem::InfoTreeItem(const detail::IObjectBase *o)
 {
     assign(o);
 }
 
+InfoTreeItem::~InfoTreeItem()
+{
+}
+
+InfoTreePool &InfoTreeItem::getPool()
+{
+    if (!pool)
+    {
+        own_pool = std::make_unique<InfoTreePool>();
+        pool = own_pool.get();
+    }
+    return *pool;
+}
+
+InfoTreeItem *InfoTreeItem::addChild(const detail::IObjectBase *o)
+{
+    auto c = getPool().allocate(this);
+    children.items.push_back(c);
+    c->assign(o);
+    children.index_valid = false;
+    return c;
+}
+
 InfoTreeItem *InfoTreeItem::findChild(const detail::IObjectBase *o)
 {
-    auto i = std::find_if(children.begin(), children.end(),
-        [o](const auto &e) {return e->object == o; });
-    if (i != children.end())
-        return i->get();
-    return nullptr;
+    return children.find(o);
 }
 
 InfoTreeItem &InfoTreeItem::operator=(const detail::IObjectBase *o)
@@ -53,11 +169,23 @@ InfoTreeItem &InfoTreeItem::operator=(const detail::IObjectBase *o)
     return *this;
 }
 
+void InfoTreeItem::reset()
+{
+    parent = nullptr;
+    text.clear();
+    object = nullptr;
+    expanded = true;
+    highlight = false;
+    hidden_if_empty = false;
+}
+
 void InfoTreeItem::assign(const detail::IObjectBase *o)
 {
     if (!o)
         return;
     object = (detail::IObjectBase *)o;
+    if (parent)
+        parent->children.index_valid = false;
     text = object->getName();
     switch (object->getType())
     {
@@ -80,11 +208,11 @@ BuildingMenu::BuildingMenu()
 #define SET_CHILD(v, e, m) *(v.children[InfoTreeItem::e]) = messages[#m]
 
     for (auto i = 0; i < InfoTreeItem::ThemesMax; i++)
-        themes.children.emplace_back(std::make_shared<InfoTreeItem>());
+        themes.addChild();
     SET_CHILD(themes, ThemesId, INT_THEMES);
 
     for (auto i = 0; i < InfoTreeItem::JournalMax; i++)
-        journal.children.emplace_back(std::make_shared<InfoTreeItem>());
+        journal.addChild();
     SET_CHILD(journal, JournalInProgress, INT_QUESTS_ACTIVE);
     SET_CHILD(journal, JournalCompleted, INT_QUESTS_COMPLETED);
     SET_CHILD(journal, JournalFailed, INT_QUESTS_FAILED);
@@ -92,7 +220,7 @@ BuildingMenu::BuildingMenu()
     SET_CHILD(journal, JournalThemes, INT_THEMES);
 
     for (auto i = 0; i < InfoTreeItem::GliderMax; i++)
-        glider.children.emplace_back(std::make_shared<InfoTreeItem>());
+        glider.addChild();
     SET_CHILD(glider, GliderGeneral, INT_PMENU_GLIDER_INFO);
     SET_CHILD(glider, GliderId, INT_PMENU_GLIDER_GLIDER);
     SET_CHILD(glider, GliderArmor, INT_PMENU_GLIDER_ARMOR);
@@ -101,23 +229,23 @@ BuildingMenu::BuildingMenu()
     SET_CHILD(glider, GliderAmmo, INT_PMENU_GLIDER_AMMO);
 
     for (auto i = 0; i < InfoTreeItem::GliderStoreMax; i++)
-        glider_store.children.emplace_back(std::make_shared<InfoTreeItem>());
+        glider_store.addChild();
     SET_CHILD(glider_store, GliderStoreId, INT_BASE_GLIDERS);
     SET_CHILD(glider_store, GliderStoreEquipment, INT_BASE_EQUIPMENT);
     SET_CHILD(glider_store, GliderStoreWeapons, INT_BASE_WEAPONS);
     SET_CHILD(glider_store, GliderStoreAmmo, INT_BASE_AMMO);
 
     for (auto i = 0; i < InfoTreeItem::HoldStoreMax; i++)
-        hold_store.children.emplace_back(std::make_shared<InfoTreeItem>());
+        hold_store.addChild();
     SET_CHILD(hold_store, HoldStoreGoods, INT_HOLD_GOODS);
 
     /*for (auto i = 0; i < InfoTreeItem::HoldMax; i++)
-        hold.children.emplace_back(std::make_shared<InfoTreeItem>());
+        hold.addChild();
     SET_CHILD(hold, HoldItems, INT_HOLD_ITEMS);
     SET_CHILD(hold, HoldGoods, INT_HOLD_GOODS);*/
 
     for (auto i = 0; i < InfoTreeItem::StoreMax; i++)
-        goods_store.children.emplace_back(std::make_shared<InfoTreeItem>());
+        goods_store.addChild();
     SET_CHILD(goods_store, StoreHas, INT_BASE_SELL);
     SET_CHILD(goods_store, StoreWants, INT_BASE_BUY);
 }
@@ -130,6 +258,8 @@ void BuildingMenu::setCurrentBuilding(detail::ModificationMapBuilding *b)
 {
     if (!b)
         return;
+    if (building != b)
+        invalidate(SectionGliderStore | SectionGoodsStore);
     building = b;
     clearThemes();
 }
@@ -138,6 +268,8 @@ void BuildingMenu::setCurrentMechanoid(detail::Mechanoid *m)
 {
     if (!m)
         return;
+    if (mechanoid != m)
+        invalidate();
     mechanoid = m;
 }
 
@@ -148,12 +280,28 @@ void BuildingMenu::setCurrentScriptCallback(ScriptCallback sc)
 
 void BuildingMenu::update()
 {
-    updateThemes();
-    updateJournal();
-    updateGlider();
-    updateGliderStore();
-    updateHoldStore();
-    updateGoodsStore();
+    auto c = static_cast<const Configuration *>(mechanoid->configuration.get());
+    auto revision = c ? c->getRevision() : 0;
+    if (c != builtConfiguration || revision != builtRevision)
+        invalidate(SectionGlider | SectionHoldStore);
+    builtConfiguration = c;
+    builtRevision = revision;
+
+    changed = dirty;
+    dirty = 0;
+
+    if (changed & SectionThemes)
+        updateThemes();
+    if (changed & SectionJournal)
+        updateJournal();
+    if (changed & SectionGlider)
+        updateGlider();
+    if (changed & SectionGliderStore)
+        updateGliderStore();
+    if (changed & SectionHoldStore)
+        updateHoldStore();
+    if (changed & SectionGoodsStore)
+        updateGoodsStore();
 }
 
 void BuildingMenu::updateThemes()
@@ -184,9 +332,8 @@ void BuildingMenu::updateJournal()
     journal.children[InfoTreeItem::JournalId]->children.clear();
     for (auto &r : p->records)
     {
-        auto c = std::make_shared<InfoTreeItem>();
+        auto c = journal.children[InfoTreeItem::JournalId]->addChild();
         c->object = r;
-        journal.children[InfoTreeItem::JournalId]->children.push_back(c);
     }
 
     journal.children[InfoTreeItem::JournalThemes]->children.clear();
@@ -202,14 +349,14 @@ void BuildingMenu::updateGlider()
     auto c = mechanoid->configuration;
 
     glider.children[InfoTreeItem::GliderId]->children.clear();
-    glider.children[InfoTreeItem::GliderId]->children.push_back(std::make_shared<InfoTreeItem>(c->glider));
+    glider.children[InfoTreeItem::GliderId]->addChild(c->glider);
 
     glider.children[InfoTreeItem::GliderWeapons]->children.clear();
     for (auto &w : c->weapons)
     {
         if (w->weapon->hidden_in_menu)
             continue;
-        glider.children[InfoTreeItem::GliderWeapons]->children.push_back(std::make_shared<InfoTreeItem>(w));
+        glider.children[InfoTreeItem::GliderWeapons]->addChild(w);
     }
 
     glider.children[InfoTreeItem::GliderArmor]->children.clear();
@@ -220,14 +367,14 @@ void BuildingMenu::updateGlider()
         {
         case detail::EquipmentType::Armor:
         case detail::EquipmentType::EnergyShield:
-            glider.children[InfoTreeItem::GliderArmor]->children.push_back(std::make_shared<InfoTreeItem>(e));
+            glider.children[InfoTreeItem::GliderArmor]->addChild(e);
             break;
         case detail::EquipmentType::Reactor:
         case detail::EquipmentType::Engine:
-            glider.children[InfoTreeItem::GliderId]->children.push_back(std::make_shared<InfoTreeItem>(e));
+            glider.children[InfoTreeItem::GliderId]->addChild(e);
             break;
         default:
-            glider.children[InfoTreeItem::GliderEquipment]->children.push_back(std::make_shared<InfoTreeItem>(e));
+            glider.children[InfoTreeItem::GliderEquipment]->addChild(e);
             break;
         }
     }
@@ -235,7 +382,7 @@ void BuildingMenu::updateGlider()
     glider.children[InfoTreeItem::GliderAmmo]->children.clear();
     for (auto &p : c->projectiles)
     {
-        glider.children[InfoTreeItem::GliderAmmo]->children.push_back(std::make_shared<InfoTreeItem>(p));
+        glider.children[InfoTreeItem::GliderAmmo]->addChild(p);
     }
 
     // maybe sort
@@ -255,25 +402,25 @@ void BuildingMenu::updateGliderStore()
     glider_store.children[InfoTreeItem::GliderStoreId]->children.clear();
     for (auto &g : building->gliders)
     {
-        glider_store.children[InfoTreeItem::GliderStoreId]->children.push_back(std::make_shared<InfoTreeItem>(g));
+        glider_store.children[InfoTreeItem::GliderStoreId]->addChild(g);
     }
 
     glider_store.children[InfoTreeItem::GliderStoreWeapons]->children.clear();
     for (auto &w : building->weapons)
     {
-        glider_store.children[InfoTreeItem::GliderStoreWeapons]->children.push_back(std::make_shared<InfoTreeItem>(w));
+        glider_store.children[InfoTreeItem::GliderStoreWeapons]->addChild(w);
     }
 
     glider_store.children[InfoTreeItem::GliderStoreEquipment]->children.clear();
     for (auto &e : building->equipments)
     {
-        glider_store.children[InfoTreeItem::GliderStoreEquipment]->children.push_back(std::make_shared<InfoTreeItem>(e));
+        glider_store.children[InfoTreeItem::GliderStoreEquipment]->addChild(e);
     }
 
     glider_store.children[InfoTreeItem::GliderStoreAmmo]->children.clear();
     for (auto &p : building->projectiles)
     {
-        glider_store.children[InfoTreeItem::GliderStoreAmmo]->children.push_back(std::make_shared<InfoTreeItem>(p));
+        glider_store.children[InfoTreeItem::GliderStoreAmmo]->addChild(p);
     }
 
     // maybe sort
@@ -295,7 +442,7 @@ void BuildingMenu::updateHoldStore()
     hold_store.children[InfoTreeItem::HoldStoreGoods]->children.clear();
     for (auto &g : c->goods)
     {
-        hold_store.children[InfoTreeItem::HoldStoreGoods]->children.push_back(std::make_shared<InfoTreeItem>(g));
+        hold_store.children[InfoTreeItem::HoldStoreGoods]->addChild(g);
     }
 
     // highlight categories
@@ -310,7 +457,7 @@ void BuildingMenu::updateGoodsStore()
     for (auto &g : building->goods)
     {
         goods_store.children[g->sell ? InfoTreeItem::StoreHas : InfoTreeItem::StoreWants]
-            ->children.push_back(std::make_shared<InfoTreeItem>(g));
+            ->addChild(g);
     }
 
     // sort by name
@@ -332,6 +479,7 @@ void BuildingMenu::updateGoodsStore()
 void BuildingMenu::refreshText()
 {
     themes.children[InfoTreeItem::ThemesId]->children.clear();
+    invalidate(SectionThemes);
     auto old = showedObjects;
     clearText();
     for (auto &o : old)
@@ -353,7 +501,8 @@ bool BuildingMenu::checkAndAddThemeObject(const detail::IObjectBase *o)
     auto c = themes.children[InfoTreeItem::ThemesId]->findChild(o);
     if (c)
         return false;
-    themes.children[InfoTreeItem::ThemesId]->children.push_back(std::make_shared<InfoTreeItem>(o));
+    themes.children[InfoTreeItem::ThemesId]->addChild(o);
+    invalidate(SectionThemes);
     return true;
 }
 
@@ -439,7 +588,19 @@ void BuildingMenu::printMessage(const detail::Message *m)
 {
     if (m->type != detail::MessageType::Text && m->title)
         printTitle(m->title->string);
-    printText(m->txt->string);
+
+    // text of the current locale, compared in place to notice another locale
+    const auto &source = m->txt->string.str();
+    if (source.empty())
+        return;
+
+    auto &c = messageTemplates[m];
+    if (c.source != source)
+    {
+        c.text.compile(source, text_tokens);
+        c.source = source;
+    }
+    printTemplate(c.text);
 }
 
 void BuildingMenu::addText(const String &t)
@@ -483,35 +644,63 @@ void BuildingMenu::clearText()
 void BuildingMenu::clearThemes()
 {
     themes.children[InfoTreeItem::ThemesId]->children.clear();
+    invalidate(SectionThemes);
 }
 
-void BuildingMenu::printText(String t)
+void BuildingMenu::printText(const String &t)
 {
     if (t.empty())
         return;
 
-    // format here!
+    // texts that are not messages are compiled every time
+    scratchTemplate.compile(t, text_tokens);
+    printTemplate(scratchTemplate);
+}
 
-    boost::algorithm::trim_right(t);
-    boost::algorithm::replace_all(t, L"<icon:POINT>", BIG_SPACE);
-    boost::algorithm::replace_all(t, L"<p>", SMALL_DELIMETER BIG_SPACE);
-    if (mechanoid->name)
-        boost::algorithm::replace_all(t, L"%NAME", mechanoid->name->string.str());
-    else
-        boost::algorithm::replace_all(t, L"%NAME", L"Unnamed");
-    boost::algorithm::replace_all(t, L"%BUILDINGNAME", building->getName());
-    boost::algorithm::replace_all(t, L"%BUILDINGREF", building->building->building->getTextId());
-    boost::algorithm::replace_all(t, L"%RATINGNAME", mechanoid->getRatingLevelName());
-    if (mechanoid->clan && mechanoid->clan->member_name)
-        boost::algorithm::replace_all(t, L"%ORGMEMBER", mechanoid->clan->member_name->string.str());
-    boost::algorithm::replace_all(t, L"%QUEST", currentQuest);
+void BuildingMenu::printTemplate(const TextTemplate &t)
+{
+    // one printed text is one segment of the screen text
+    printBuffer.clear();
 
-    text += t;
-    text += String(SMALL_DELIMETER);
+    // slot values are computed only for slots the text has
+    t.expand(printBuffer, [this](int slot, String &out)
+    {
+        switch (slot)
+        {
+        case SlotName:
+            if (mechanoid->name)
+                out += mechanoid->name->string.str();
+            else
+                out += L"Unnamed";
+            break;
+        case SlotBuildingName:
+            out += building->getName();
+            break;
+        case SlotBuildingRef:
+            out += String(building->building->building->getTextId());
+            break;
+        case SlotRatingName:
+            out += mechanoid->getRatingLevelName();
+            break;
+        case SlotOrgMember:
+            // kept as is without a clan
+            if (mechanoid->clan && mechanoid->clan->member_name)
+                out += mechanoid->clan->member_name->string.str();
+            else
+                out += L"%ORGMEMBER";
+            break;
+        case SlotQuest:
+            out += currentQuest;
+            break;
+        }
+    });
+    printBuffer += String(SMALL_DELIMETER);
+    text.append(printBuffer);
 }
 
 void BuildingMenu::JournalRecordAdded()
 {
+    invalidate(SectionJournal);
     printMessage(GET_MESSAGE("INT_JOURNAL_UPDATED"));
 }
 
@@ -543,12 +732,12 @@ void BuildingMenu::saveScreenText()
 {
     if (!mainScreenText.empty())
         return;
-    mainScreenText = text;
+    mainScreenText.assign(text);
 }
 
 void BuildingMenu::loadScreenText()
 {
-    text = mainScreenText;
+    text.assign(mainScreenText);
     mainScreenText.clear();
 }
 
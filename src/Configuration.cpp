@@ -21,6 +21,9 @@
 #include <Polygon4/ConfigurationWeapon.h>
 #include <Polygon4/Engine.h>
 #include <Polygon4/Mechanoid.h>
+#include <Polygon4/Modification.h>
+
+#include "Script.h"
 
 #include <tools/Logger.h>
 DECLARE_STATIC_LOGGER(logger, "configuration");
@@ -96,10 +99,20 @@ void Configuration::addItem(IObjectBase *o, int quantity)
     default:
         return;
     }
+
+    // resume scripts waiting for this item
+    if (mechanoid && mechanoid->isPlayer())
+    {
+        auto m = getEngine()->getCurrentModification();
+        if (m && m->getScriptEngine())
+            m->getScriptEngine()->onItemAdded(mechanoid->getPlayer(), o);
+    }
 }
 
 void Configuration::addEquipment(detail::Equipment *o, int quantity)
 {
+    invalidateStats();
+
     auto i = std::find_if(equipments.begin(), equipments.end(),
         [o](const auto &e) { return e->equipment.get() == o; });
     if (i != equipments.end())
@@ -123,12 +136,16 @@ void Configuration::addEquipment(detail::Equipment *o, int quantity)
 
 void Configuration::addGlider(detail::Glider *o)
 {
+    invalidateStats();
+
     mechanoid->sell(glider->price);
     glider = o;
 }
 
 void Configuration::addGood(detail::Good *o, int quantity)
 {
+    invalidateStats();
+
     auto i = std::find_if(goods.begin(), goods.end(),
         [o](const auto &e) { return e->good.get() == o; });
     if (i != goods.end())
@@ -152,6 +169,8 @@ void Configuration::addGood(detail::Good *o, int quantity)
 
 void Configuration::addModificator(detail::Modificator *o, int quantity)
 {
+    invalidateStats();
+
     auto i = std::find_if(modificators.begin(), modificators.end(),
         [o](const auto &e) { return e->modificator.get() == o; });
     if (i != modificators.end())
@@ -175,6 +194,8 @@ void Configuration::addModificator(detail::Modificator *o, int quantity)
 
 void Configuration::addProjectile(detail::Projectile *o, int quantity)
 {
+    invalidateStats();
+
     auto i = std::find_if(projectiles.begin(), projectiles.end(),
         [o](const auto &e) { return e->projectile.get() == o; });
     if (i != projectiles.end())
@@ -193,6 +214,8 @@ void Configuration::addProjectile(detail::Projectile *o, int quantity)
 
 void Configuration::addWeapon(detail::Weapon *w)
 {
+    invalidateStats();
+
     // glider cannot take such weapon type)
     if (glider->standard < w->standard)
     {
@@ -362,6 +385,8 @@ bool Configuration::hasItem(const IObjectBase *o, int quantity) const
 
 bool Configuration::removeItem(IObjectBase *o, int quantity)
 {
+    invalidateStats();
+
     if (glider.get() == o)
     {
         glider.reset();
@@ -398,17 +423,48 @@ bool Configuration::removeItem(IObjectBase *o, int quantity)
     return false;
 }
 
-float Configuration::getMass() const
+void Configuration::updateStats() const
 {
-    float mass = 0.0f;
+    if (!stats_dirty)
+        return;
 
-#define ADD_MASS(m) for (auto &v : m ## s) mass += v->m->weight
+    equipment_stats.clear();
+    equipment_stats.reserve(equipments.size());
+    for (auto &v : equipments)
+    {
+        auto &e = v->equipment;
+        ItemStats s;
+        s.type = e->type;
+        s.power = e->power;
+        s.value1 = e->value1;
+        s.value2 = e->value2;
+        s.value3 = e->value3;
+        s.weight = e->weight;
+        equipment_stats.push_back(s);
+    }
+
+    items_mass = 0.0f;
+
+#define ADD_MASS(m) for (auto &v : m ## s) items_mass += v->m->weight
     ADD_MASS(equipment);
     ADD_MASS(good);
     ADD_MASS(projectile);
     ADD_MASS(weapon);
+#undef ADD_MASS
+
+    stats_dirty = false;
+}
 
-    return mass;
+const std::vector<ItemStats> &Configuration::getEquipmentStats() const
+{
+    updateStats();
+    return equipment_stats;
+}
+
+float Configuration::getMass() const
+{
+    updateStats();
+    return items_mass;
 }
 
 float Configuration::getTotalMass() const
@@ -431,10 +487,10 @@ float Configuration::getMaxEnergy() const
     float max_energy = 0.0f;
 
     // additions from equipment
-    for (auto &v : equipments)
+    for (auto &v : getEquipmentStats())
     {
-        if (v->equipment->type == detail::EquipmentType::Reactor)
-            max_energy += v->equipment->value1 * 3 * 10;
+        if (v.type == detail::EquipmentType::Reactor)
+            max_energy += v.value1 * 3 * 10;
     }
 
     return max_energy;
@@ -450,10 +506,10 @@ float Configuration::getMaxEnergyShield() const
     float max_energy_shield = 0.0f;
 
     // additions from equipment
-    for (auto &v : equipments)
+    for (auto &v : getEquipmentStats())
     {
-        if (v->equipment->type == detail::EquipmentType::EnergyShield)
-            max_energy_shield += v->equipment->value1;
+        if (v.type == detail::EquipmentType::EnergyShield)
+            max_energy_shield += v.value1;
     }
 
     return max_energy_shield;
@@ -492,12 +548,12 @@ void Configuration::hit(detail::Projectile *projectile)
 
     // additions from equipment
     bool has_shield = false;
-    for (auto &v : equipments)
+    for (auto &v : getEquipmentStats())
     {
-        if (v->equipment->type == detail::EquipmentType::EnergyShield)
+        if (v.type == detail::EquipmentType::EnergyShield)
         {
             has_shield = true;
-            if (damage <= v->equipment->value2)
+            if (damage <= v.value2)
             {
                 // full absorb
                 energy_shield -= damage;
@@ -511,8 +567,8 @@ void Configuration::hit(detail::Projectile *projectile)
             else
             {
                 // partial absorb
-                energy_shield -= v->equipment->value2;
-                damage -= v->equipment->value2;
+                energy_shield -= v.value2;
+                damage -= v.value2;
                 if (energy_shield < 0)
                 {
                     // pass to armor
@@ -544,19 +600,21 @@ void Configuration::tick(float delta_seconds)
 {
     // TODO: fix calculations
 
+    auto &stats = getEquipmentStats();
+
     // shield energy consumption & restore
-    for (auto &v : equipments)
+    for (auto &v : stats)
     {
-        if (v->equipment->type == detail::EquipmentType::EnergyShield)
+        if (v.type == detail::EquipmentType::EnergyShield)
         {
             // consumption
-            energy -= v->equipment->power * delta_seconds;
+            energy -= v.power * delta_seconds;
 
             auto max = getMaxEnergyShield();
             if (energy > 0 && energy_shield < max)
             {
                 // restore
-                energy_shield += v->equipment->value3 * delta_seconds;
+                energy_shield += v.value3 * delta_seconds;
                 if (energy_shield > max)
                     energy_shield = max;
             }
@@ -567,11 +625,11 @@ void Configuration::tick(float delta_seconds)
     }
 
     // energy restore
-    for (auto &v : equipments)
+    for (auto &v : stats)
     {
-        if (v->equipment->type == detail::EquipmentType::Reactor)
+        if (v.type == detail::EquipmentType::Reactor)
         {
-            energy += v->equipment->value1 * delta_seconds;
+            energy += v.value1 * delta_seconds;
             auto max = getMaxEnergy();
             if (energy > max)
                 energy = max;
@@ -32,25 +32,42 @@ ConfigurationWeapon::ConfigurationWeapon(const Base &rhs)
 {
 }
 
+const ItemStats &ConfigurationWeapon::getStats()
+{
+    if (stats_weapon == weapon.get())
+        return stats;
+
+    stats_weapon = weapon.get();
+    stats = ItemStats();
+    if (weapon)
+    {
+        stats.power = weapon->power;
+        stats.weight = weapon->weight;
+        stats.firerate = weapon->firerate;
+    }
+    return stats;
+}
+
 void ConfigurationWeapon::addTime(float tick)
 {
     if (ready)
         return;
     current_time += tick;
     if (weapon)
-        ready = current_time >= (60.0f / weapon->firerate);
+        ready = current_time >= (60.0f / getStats().firerate);
     if (ready)
         current_time = 0;
 }
 
 bool ConfigurationWeapon::shoot()
 {
-    if (configuration->energy < weapon->power)
+    auto power = getStats().power;
+    if (configuration->energy < power)
         return false;
     if (!ready)
         return false;
 
-    configuration->energy -= weapon->power;
+    configuration->energy -= power;
 
     ready = false;
     return true;
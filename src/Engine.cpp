@@ -18,6 +18,9 @@
 
 #include <Polygon4/Engine.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <boost/range.hpp>
 
 #include <Polygon4/DataManager/Database.h>
@@ -25,6 +28,7 @@
 #include <Polygon4/Modification.h>
 
 #include "Common.h"
+#include "Script.h"
 
 #include "tools/Logger.h"
 DECLARE_STATIC_LOGGER(logger, "engine");
@@ -63,6 +67,8 @@ Engine::Engine(const String &gameDirectory)
 
     // initial settings
     getSettings().dirs.setGameDir(gameDirectory);
+    if (auto e = getenv("P4_LUA_PROFILE"); e && *e && strcmp(e, "0") != 0)
+        engineSettings.scripts.profile = true;
 
     reloadStorage();
 }
@@ -315,4 +321,47 @@ void Engine::deleteSaveGame(const String &fn) const
         fs::remove(p);
 }
 
+static ScriptEngine *get_script_engine(const Modification *m)
+{
+    if (!m || !m->getScriptEngine())
+    {
+        LOG_ERROR(logger, "No game is running");
+        return nullptr;
+    }
+    return m->getScriptEngine();
+}
+
+bool Engine::startScriptTrace(const String &name)
+{
+    auto se = get_script_engine(currentModification);
+    return se && se->startTrace(name.toString());
+}
+
+void Engine::stopScriptTrace()
+{
+    if (currentModification && currentModification->getScriptEngine())
+        currentModification->getScriptEngine()->stopTrace();
+}
+
+bool Engine::replayScriptTrace(const String &fn)
+{
+    path p = fn.toString();
+    std::string snapshot;
+    try
+    {
+        snapshot = ScriptTraceReader(p).getSnapshot();
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR(logger, "Cannot read script trace: " << e.what());
+        return false;
+    }
+
+    // calls are replayed against the state they were recorded in
+    if (!load(String(snapshot)))
+        return false;
+    auto se = get_script_engine(currentModification);
+    return se && se->replayTrace(p);
+}
+
 } // namespace polygon4
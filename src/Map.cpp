@@ -18,6 +18,8 @@
 
 #include <Polygon4/Map.h>
 
+#include <Polygon4/Engine.h>
+
 #include <tools/Logger.h>
 DECLARE_STATIC_LOGGER(logger, "maps");
 
@@ -31,6 +33,38 @@ Map::Map(const Base &rhs)
 
 bool Map::loadObjects()
 {
+    auto &ss = GET_ENGINE_SETTINGS().streaming;
+    streaming = ss.enabled;
+    streamer.reset(ss.spawn_radius);
+
+    if (streaming)
+    {
+        // objects are spawned in updateStreaming()
+        for (auto &v : buildings)
+        {
+            if (v->enabled)
+                streamer.add(v, (float)v->x, (float)v->y);
+        }
+        for (auto &v : objects)
+        {
+            if (v->enabled)
+                streamer.add(v, (float)v->x, (float)v->y);
+        }
+        streamer.Spawn = [](detail::IObjectBase *o)
+        {
+            if (auto b = dynamic_cast<detail::MapBuilding *>(o))
+                b->spawn();
+            else if (auto m = dynamic_cast<detail::MapObject *>(o))
+                m->spawn();
+        };
+        streamer.Despawn = [this](detail::IObjectBase *o)
+        {
+            return DespawnObject && DespawnObject(o);
+        };
+        LOG_DEBUG(logger, "Streaming " << streamer.size() << " objects");
+        return true;
+    }
+
     for (auto &v : buildings)
     {
         if (v->enabled)
@@ -44,4 +78,11 @@ bool Map::loadObjects()
     return true;
 }
 
+void Map::updateStreaming(float x, float y)
+{
+    if (!streaming)
+        return;
+    streamer.update(x, y, GET_ENGINE_SETTINGS().streaming);
+}
+
 } // namespace polygon4
@@ -106,7 +106,8 @@ void Mechanoid::enterBuilding(detail::MapBuilding *bld)
     building = mmb;
     if (!isPlayer())
     {
-        // handle bot's building visit
+        // bot scripts run on worker threads, changes are applied on the next frame
+        mmb->map->modification->getScriptEngine()->onBotBuildingVisit(this, mmb);
         return;
     }
 
@@ -122,8 +123,7 @@ void Mechanoid::enterBuilding(detail::MapBuilding *bld)
 
     // now run scripts
     auto se = mmb->map->modification->getScriptEngine();
-    path script_file = path("maps") / mmb->map->script_dir.toString() / mmb->script_name.toString();
-    auto s = se->getScript(script_file.string());
+    auto s = se->beginVisit(ScriptEngine::getBuildingScriptName(mmb));
 
     // set player visit
     auto iter = player->buildings.find_if([mmb](const auto &vb)
@@ -159,6 +159,10 @@ void Mechanoid::enterBuilding(detail::MapBuilding *bld)
     // main script call
     s->OnEnterBuilding();
 
+    // resume scripts waiting for this visit, their texts go to this menu
+    se->onBuildingVisit(player, mmb);
+    se->resume();
+
     // update building menu
     bm->refresh();
     e->ShowBuildingMenu();
@@ -20,9 +20,12 @@
 
 #include <Polygon4/DataManager/Types.h>
 #include <Polygon4/Engine.h>
+#include <Polygon4/Map.h>
 
 #include "Script.h"
 
+#include <primitives/executor.h>
+
 #include <tools/Logger.h>
 DECLARE_STATIC_LOGGER(logger, "mods");
 
@@ -36,9 +39,69 @@ Modification::Modification(const Base &rhs)
 
 Modification::~Modification()
 {
+    // the worker uses this object
+    if (loader.valid())
+        loader.wait();
 }
 
 bool Modification::newGame()
+{
+    if (!prepareNewGame())
+        return false;
+    runLoadingStages();
+    return finishNewGame();
+}
+
+bool Modification::newGameAsync()
+{
+    if (isLoading())
+    {
+        LOG_ERROR(logger, "Game is already loading");
+        return false;
+    }
+    if (!prepareNewGame())
+        return false;
+
+    auto done = std::make_shared<std::promise<void>>();
+    loader = done->get_future();
+
+    static Executor ex(1, "loader");
+    ex.push([this, done]()
+    {
+        runLoadingStages();
+        done->set_value();
+    });
+    return true;
+}
+
+bool Modification::updateLoading()
+{
+    // game thread part
+    auto s = loadingStage.load();
+    if (s != LoadingStage::GameThread)
+        return s == LoadingStage::None || s == LoadingStage::Failed;
+    finishNewGame();
+    return true;
+}
+
+bool Modification::isLoading() const
+{
+    auto s = loadingStage.load();
+    return s != LoadingStage::None && s != LoadingStage::Failed;
+}
+
+void Modification::update()
+{
+    // the worker rebuilds the map index while loading
+    if (isLoading())
+        return;
+    updateMechanoidPositions();
+    updateStreaming();
+    if (scriptEngine)
+        scriptEngine->update();
+}
+
+bool Modification::prepareNewGame()
 {
     if (directory.empty())
     {
@@ -50,47 +113,103 @@ bool Modification::newGame()
         LOG_ERROR(logger, "Script language is not set!");
         return false;
     }
+    loadingProgress = 0.0f;
+    loadingStage = LoadingStage::Index;
+    return true;
+}
 
+void Modification::runLoadingStages()
+{
+    // cpu only stages, must not touch the game side
+    // the script engine is published to the game thread in finishNewGame()
     try
     {
-        scriptEngine = std::make_unique<ScriptEngine>(path(getEngine()->getSettings().dirs.mods.c_str()) / directory.c_str(), script_language);
+        LOG_DEBUG(logger, "Loading stage: index");
+        loadingStage = LoadingStage::Index;
+        buildMapIndex();
+        loadingProgress = 0.1f;
+
+        const MapIndex *mi = nullptr;
+        auto this_player = findLocalPlayer();
+        if (this_player && this_player->mechanoid->map)
+            mi = getMapIndex(this_player->mechanoid->map->map.get());
 
-        detail::ModificationPlayer *this_player = nullptr;
+        // compile building scripts of the start map
+        LOG_DEBUG(logger, "Loading stage: scripts");
+        loadingStage = LoadingStage::Scripts;
+        auto se = std::make_unique<ScriptEngine>(path(getEngine()->getSettings().dirs.mods.c_str()) / directory.c_str(), script_language, this);
         for (auto &p : players)
+            se->getTimers().load(p);
+        if (mi)
         {
-            if (p->player == player)
+            size_t i = 0;
+            for (auto &b : mi->buildings)
             {
-                this_player = p;
-                break;
+                se->preloadScript(ScriptEngine::getBuildingScriptName(b));
+                loadingProgress = 0.1f + 0.65f * ++i / mi->buildings.size();
             }
         }
+        loadedScriptEngine = std::move(se);
+        loadingProgress = 0.75f;
+
+        loadingStage = LoadingStage::GameThread;
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR(logger, "Cannot start game: " << e.what());
+        loadingStage = LoadingStage::Failed;
+    }
+}
+
+bool Modification::finishNewGame()
+{
+    if (loadingStage != LoadingStage::GameThread)
+        return false;
+
+    LOG_DEBUG(logger, "Loading stage: game thread");
+    loadingStage = LoadingStage::Failed;
+    scriptEngine = std::move(loadedScriptEngine);
+
+    try
+    {
+        auto this_player = findLocalPlayer();
         if (!this_player)
         {
             LOG_ERROR(logger, "Cannot find a local player for this modification");
             return false;
         }
         auto &pmap = this_player->mechanoid->map;
-        auto i = std::find_if(maps.begin(), maps.end(), [&pmap](const auto &map)
-        {
-            return map->map == pmap;
-        });
-        if (i == maps.end())
+        auto mi = getMapIndex(pmap->map.get());
+        if (!mi || !mi->map)
         {
             LOG_ERROR(logger, "Cannot find map: " << pmap->map->resource.toString());
             return false;
         }
 
+        // configurations create storage objects
+        for (auto &m : mi->mechanoids)
+            m->getConfiguration();
+
         if (!pmap->map->loadLevel())
             return false;
         currentMap = pmap->map;
+        // set again when mechanoids are spawned
+        currentPlayer = nullptr;
 
         // destroy old building menu data before new game starts
         getEngine()->DestroyBuildingMenu();
 
         getEngine()->HideMainMenu();
-        getEngine()->LoadLevelObjects = [this, pmap]()
+        getEngine()->LoadLevelObjects = [this, pmap, this_player]()
         {
             pmap->map->loadObjects();
+
+            // spawn the first ring around the player now,
+            // Modification::update() streams the rest as the player moves
+            auto m = dynamic_cast<Map *>(pmap->map.get());
+            if (m && m->isStreaming())
+                m->updateStreaming(this_player->mechanoid->x, this_player->mechanoid->y);
+
             for (auto &b : pmap->buildings)
             {
                 if (b->building)
@@ -107,6 +226,8 @@ bool Modification::newGame()
         return false;
     }
     getEngine()->setCurrentModification(this);
+    loadingProgress = 1.0f;
+    loadingStage = LoadingStage::None;
     return true;
 }
 
@@ -120,6 +241,75 @@ bool Modification::operator<(const Modification &rhs) const
     return directory < rhs.directory;
 }
 
+detail::ModificationPlayer *Modification::findLocalPlayer() const
+{
+    for (auto &p : players)
+    {
+        if (p->player == player)
+            return p;
+    }
+    return nullptr;
+}
+
+void Modification::buildMapIndex()
+{
+    mapIndex.clear();
+    for (auto &m : maps)
+    {
+        if (!m->map)
+            continue;
+        auto &mi = mapIndex[m->map.get()];
+        mi.map = m;
+        mi.buildings.reserve(m->buildings.size());
+        for (auto &b : m->buildings)
+        {
+            mi.buildings.push_back(b);
+            if (b->building)
+                mi.building_positions.insert(b, b->building->x, b->building->y);
+        }
+    }
+    for (auto &m : mechanoids)
+    {
+        if (!m->map || !m->map->map)
+            continue;
+        auto &mi = mapIndex[m->map->map.get()];
+        mi.mechanoids.push_back(m);
+        mi.mechanoid_positions.insert(m, m->x, m->y);
+    }
+}
+
+const MapIndex *Modification::getMapIndex(const detail::Map *map) const
+{
+    auto i = mapIndex.find(map);
+    if (i == mapIndex.end())
+        return nullptr;
+    return &i->second;
+}
+
+void Modification::updateMechanoidPositions()
+{
+    // only the current map has moving mechanoids
+    auto i = mapIndex.find(currentMap);
+    if (i == mapIndex.end())
+        return;
+    auto &mi = i->second;
+    for (auto &m : mi.mechanoids)
+    {
+        float x, y;
+        if (mi.mechanoid_positions.getPosition(m, x, y) && (x != m->x || y != m->y))
+            mi.mechanoid_positions.update(m, m->x, m->y);
+    }
+}
+
+void Modification::updateStreaming()
+{
+    // map objects follow the local player
+    if (!currentPlayer || !currentPlayer->mechanoid)
+        return;
+    if (auto m = dynamic_cast<Map *>(currentMap))
+        m->updateStreaming(currentPlayer->mechanoid->x, currentPlayer->mechanoid->y);
+}
+
 void Modification::spawnMechanoids()
 {
     if (!currentMap)
@@ -136,11 +326,11 @@ void Modification::spawnMechanoids()
         // for now we allow only one local player
         break;
     }
-    for (auto &m : mechanoids)
-    {
-        if (m->map->map == *currentMap)
-            m->spawn();
-    }
+    auto mi = getMapIndex(currentMap);
+    if (!mi)
+        return;
+    for (auto &m : mi->mechanoids)
+        m->spawn();
 }
 
 void Modification::spawnCurrentPlayer()
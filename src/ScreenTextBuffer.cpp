@@ -0,0 +1,164 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Polygon4/ScreenTextBuffer.h>
+
+#include <algorithm>
+
+namespace polygon4
+{
+
+void ScreenTextBuffer::append(const String &s)
+{
+    if (s.empty())
+        return;
+    version++;
+
+    // same text as before clear(), unless the ui has seen the text without it
+    if (visible < segments.size() && observed < cleared && segments[visible].text == s)
+    {
+        visible++;
+        return;
+    }
+
+    dropRemoved();
+    segments.push_back({ s, size(), version });
+    visible++;
+}
+
+void ScreenTextBuffer::appendUtf8(std::string_view s)
+{
+    decoded.clear();
+    for (size_t i = 0; i < s.size();)
+    {
+        auto c = (unsigned char)s[i];
+        int n = c < 0x80 ? 0 : c >= 0xF0 && c < 0xF5 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : -1;
+        uint32_t cp = n == 0 ? c : n == 1 ? c & 0x1F : n == 2 ? c & 0x0F : c & 0x07;
+        auto ok = n >= 0 && i + n < s.size();
+        for (int k = 1; ok && k <= n; k++)
+        {
+            auto cc = (unsigned char)s[i + k];
+            ok = (cc & 0xC0) == 0x80;
+            cp = (cp << 6) | (cc & 0x3F);
+        }
+        // overlong forms, surrogates and out of range values
+        static const uint32_t min_cp[] = { 0, 0x80, 0x800, 0x10000 };
+        if (!ok || cp < min_cp[n] || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+        {
+            decoded += (wchar_t)0xFFFD;
+            i++;
+            continue;
+        }
+        i += n + 1;
+        if (sizeof(wchar_t) == 2 && cp >= 0x10000)
+        {
+            cp -= 0x10000;
+            decoded += (wchar_t)(0xD800 + (cp >> 10));
+            decoded += (wchar_t)(0xDC00 + (cp & 0x3FF));
+        }
+        else
+            decoded += (wchar_t)cp;
+    }
+    append(decoded);
+}
+
+void ScreenTextBuffer::clear()
+{
+    if (visible == 0)
+        return;
+    // the ui has seen the text since the last clear(), so segments removed
+    // before it are not in the ui text anymore and must not be reused
+    if (observed >= cleared)
+        dropRemoved();
+    visible = 0;
+    cleared = ++version;
+}
+
+void ScreenTextBuffer::dropRemoved()
+{
+    // joined text must not keep removed segments
+    if (joined_count > visible)
+    {
+        joined.resize(size());
+        joined_count = visible;
+    }
+    segments.resize(visible);
+}
+
+void ScreenTextBuffer::assign(const ScreenTextBuffer &other)
+{
+    if (this == &other)
+        return;
+    clear();
+    for (size_t i = 0; i < other.visible; i++)
+        append(other.segments[i].text);
+}
+
+size_t ScreenTextBuffer::size() const
+{
+    if (visible == 0)
+        return 0;
+    auto &s = segments[visible - 1];
+    return s.offset + s.text.size();
+}
+
+bool ScreenTextBuffer::endsWith(const String &s) const
+{
+    auto &t = join();
+    return s.size() <= t.size() && std::equal(s.begin(), s.end(), t.end() - s.size());
+}
+
+const String &ScreenTextBuffer::str() const
+{
+    observed = version;
+    return join();
+}
+
+const String &ScreenTextBuffer::join() const
+{
+    if (joined_count != visible)
+    {
+        auto n = std::min(joined_count, visible);
+        joined.resize(n ? segments[n - 1].offset + segments[n - 1].text.size() : 0);
+        for (auto i = n; i < visible; i++)
+            joined += segments[i].text;
+        joined_count = visible;
+    }
+    return joined;
+}
+
+ScreenTextBuffer::Delta ScreenTextBuffer::getDelta(uint64_t since) const
+{
+    Delta d;
+    d.version = observed = version;
+
+    // the ui is ahead, e.g. it was synced with another building menu
+    if (since > version)
+        since = 0;
+
+    // versions grow along the segments
+    auto first = std::upper_bound(segments.begin(), segments.begin() + visible, since,
+        [](uint64_t v, const auto &s) { return v < s.version; });
+    d.keep = first == segments.begin() + visible ? size() : first->offset;
+    for (; first != segments.begin() + visible; ++first)
+        d.appended += first->text;
+    return d;
+}
+
+} // namespace polygon4
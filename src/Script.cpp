@@ -18,8 +18,12 @@
 
 #include "Script.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include <Polygon4/Engine.h>
 
+#include "ScriptBytecode.h"
 #include "ScriptLua.h"
 
 #include <tools/Logger.h>
@@ -32,73 +36,534 @@ Script::Script()
 {
 }
 
-void Script::loadFile(const path &p)
+bool Script::loadFile(const path &p)
 {
+    auto add_file = [this](const path &p)
+    {
+        std::error_code ec;
+        files.emplace_back(p, fs::last_write_time(p, ec));
+        return true;
+    };
+
     LOG_TRACE(logger, "Trying to load '" << getScriptExtension() << "' script file: " << p.string());
 
-    if (loadScriptFile(p))
-        return;
-
-    // try with extension
-    auto p2 = p;
+    if (loadScriptFile(p))
+        return add_file(p);
+
+    // try with extension
+    auto p2 = p;
     p2 += "." + getScriptExtension();
 
-    LOG_TRACE(logger, "Trying to load '" << getScriptExtension() << "' script file: " << p2.string());
+    LOG_TRACE(logger, "Trying to load '" << getScriptExtension() << "' script file: " << p2.string());
 
     // if file could not be loaded, do nothing
     if (loadScriptFile(p2))
-        return;
+        return add_file(p2);
 
     LOG_ERROR(logger, "Cannot load '" << getScriptExtension() << "' script file: " << p.string());
+    return false;
 }
 
-ScriptEngine::ScriptEngine(const path &p, ScriptLanguage language)
-    : root(p / "Scripts"), language(language)
+bool Script::isOutdated() const
 {
+    for (auto &[p, t] : files)
+    {
+        std::error_code ec;
+        if (fs::last_write_time(p, ec) != t)
+            return true;
+    }
+    return false;
 }
 
-Script *ScriptEngine::getScript(const std::string &name)
+ScriptEngine::ScriptEngine(const path &p, ScriptLanguage language, const detail::Modification *modification)
+    : root(p / "Scripts"), profileDir(p / "Profiles"), traceDir(p / "Traces"), language(language)
+    , timers(variables), references(modification)
 {
-    auto fn = root / name;
+    const auto &settings = getEngine()->getEngineSettings().scripts;
+    if (settings.bytecode_cache)
+        bytecodeCache = std::make_unique<LuaBytecodeCache>(p / "Cache" / "Bytecode");
+    if (settings.hot_reload)
+        watcher = std::make_unique<ScriptWatcher>(root, settings.hot_reload_poll_ms);
+    createContext();
+}
 
-    LOG_TRACE(logger, "Creating '" << str(language).toString() << "' script executor on file: " << fn.string());
+ScriptEngine::~ScriptEngine()
+{
+    stopTrace();
+}
+
+void ScriptEngine::createContext()
+{
+    LOG_TRACE(logger, "Creating '" << str(language).toString() << "' script context");
+
+    if (context)
+    {
+        logStats();
+        if (profiling)
+            context->stopProfiling(profileDir);
+    }
+    profiling = false;
+
+    // workers keep their own copy of the common script
+    if (bots)
+    {
+        bots->sync();
+        bots.reset();
+    }
+
+    visiting = nullptr;
+    scripts.clear();
+    common.reset();
+    context.reset();
 
-    std::unique_ptr<Script> script;
     try
     {
         switch (language)
         {
         case ScriptLanguage::Lua:
-            script = std::make_unique<ScriptLua>();
+            context = std::make_unique<ScriptLuaContext>(bytecodeCache.get(),
+                getEngine()->getEngineSettings().scripts.memory_limit,
+                getEngine()->getEngineSettings().scripts.jit);
             break;
         default:
             LOG_FATAL(logger, "This language '" << (std::string)str(language) << "' is not supported!");
-            script = std::make_unique<Script>();
             break;
         }
     }
     catch (const std::exception &e)
+    {
+        LOG_ERROR(logger, "Cannot create script context: " << e.what());
+    }
+    if (!context)
+        context = std::make_unique<ScriptContext>();
+
+    auto &settings = getEngine()->getEngineSettings().scripts;
+    setProfiling(settings.profile);
+    context->setBudget(settings.instruction_budget, settings.time_budget_ms);
+    context->setTrace(traceWriter.get());
+
+    // common file is loaded once for all scripts
+    common = context->createCommonScript();
+    common->name = "common";
+    common->loadFile(root / "common");
+    scanReferences(*common);
+}
+
+std::string ScriptEngine::getBuildingScriptName(const detail::ModificationMapBuilding *b)
+{
+    return (path("maps") / b->map->script_dir.toString() / b->script_name.toString()).string();
+}
+
+Script *ScriptEngine::getScript(const std::string &name)
+{
+    // settings may be changed at runtime
+    auto &settings = getEngine()->getEngineSettings().scripts;
+    if (settings.profile != profiling)
+        setProfiling(!profiling);
+    context->setBudget(settings.instruction_budget, settings.time_budget_ms);
+
+    // the watcher reloads changed scripts in update() and beginVisit()
+    // the visited script stays until the next visit
+    if (!watcher && !visiting && common->isOutdated())
+    {
+        LOG_DEBUG(logger, "Common script was changed, reloading all scripts");
+        createContext();
+    }
+
+    auto fn = root / name;
+
+    auto i = scripts.find(fn.string());
+    if (i == scripts.end() || (!watcher && i->second.get() != visiting && i->second->isOutdated()))
+    {
+        if (i != scripts.end())
+            LOG_DEBUG(logger, "Reloading changed script: " << fn.string());
+        auto &s = scripts[fn.string()];
+        s = createScript(fn);
+        s->name = name;
+        scanReferences(*s);
+        return s.get();
+    }
+
+    // reset data from the previous call, the visit keeps its data
+    if (i->second.get() != visiting)
+        i->second->data = ScriptData();
+    return i->second.get();
+}
+
+Script *ScriptEngine::beginVisit(const std::string &name)
+{
+    // changes are applied before the script runs, not after the visit
+    visiting = nullptr;
+    if (watcher)
+        reloadChanged();
+    visiting = getScript(name);
+    return visiting;
+}
+
+void ScriptEngine::preloadScript(const std::string &name)
+{
+    getScript(name);
+}
+
+void ScriptEngine::scanReferences(const Script &s)
+{
+    for (auto &[f, _] : s.files)
+    {
+        if (auto n = references.scan(f))
+            LOG_WARN(logger, "Script " << f.string() << " has " << n << " unknown ids");
+    }
+}
+
+ScriptMemoryStats ScriptEngine::getMemoryStats() const
+{
+    return context->getMemoryStats();
+}
+
+std::vector<std::pair<std::string, size_t>> ScriptEngine::getScriptMemoryUsage() const
+{
+    std::vector<std::pair<std::string, size_t>> v;
+    v.reserve(scripts.size() + 1);
+    v.emplace_back((root / "common").string(), common->getMemoryUsage());
+    for (auto &[n, s] : scripts)
+        v.emplace_back(n, s->getMemoryUsage());
+    std::sort(v.begin(), v.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+    return v;
+}
+
+void ScriptEngine::setProfiling(bool enable)
+{
+    getEngine()->getEngineSettings().scripts.profile = enable;
+    if (enable == profiling)
+        return;
+    profiling = enable;
+    if (enable)
+    {
+        LOG_DEBUG(logger, "Script profiling is started");
+        context->startProfiling(getEngine()->getEngineSettings().scripts.profile_sample_interval);
+    }
+    else
+        context->stopProfiling(profileDir);
+}
+
+void ScriptEngine::reloadChanged()
+{
+    auto changes = watcher->getChanges();
+    changes.insert(changes.end(), deferredChanges.begin(), deferredChanges.end());
+    deferredChanges.clear();
+    if (changes.empty())
+        return;
+    for (auto &p : changes)
+        p = p.lexically_normal();
+    std::sort(changes.begin(), changes.end());
+
+    auto changed = [&changes](const path &p)
+    {
+        return std::binary_search(changes.begin(), changes.end(), p.lexically_normal());
+    };
+    auto is_changed = [&changed](const Script &s, const path &fn)
+    {
+        // script that failed to load is retried when its file appears
+        if (s.files.empty())
+            return changed(fn) || changed(path(fn) += "." + s.getScriptExtension());
+        for (auto &[f, _] : s.files)
+        {
+            if (changed(f))
+                return true;
+        }
+        return false;
+    };
+
+    if (changed(root) || is_changed(*common, root / "common"))
+    {
+        // all scripts are recreated, wait for the visit to end
+        if (visiting)
+        {
+            deferredChanges = std::move(changes);
+            return;
+        }
+        LOG_DEBUG(logger, "Common script was changed, reloading all scripts");
+        createContext();
+        return;
+    }
+    for (auto &[fn, s] : scripts)
+    {
+        if (!is_changed(*s, fn))
+            continue;
+        if (s.get() == visiting)
+        {
+            deferredChanges.push_back(fn);
+            for (auto &[f, _] : s->files)
+                deferredChanges.push_back(f);
+            continue;
+        }
+        LOG_DEBUG(logger, "Reloading changed script: " << fn);
+        auto name = s->name;
+        s = createScript(fn);
+        s->name = name;
+        scanReferences(*s);
+    }
+}
+
+void ScriptEngine::update()
+{
+    // safe point, no script is running
+    if (watcher)
+        reloadChanged();
+
+    auto playtime = (int64_t)GET_SETTINGS().playtime;
+    timers.update(playtime, [this](auto player, const auto &name, const auto &t)
+    {
+        // getScript() loads building scripts only
+        auto s = t.script == common->getName() ? common.get() : getScript(t.script);
+        // the building menu may still use the data of the visit
+        auto data = s->data;
+        s->data = ScriptData();
+        s->data.script = s;
+        s->data.player = player;
+        s->invoke(t.callback, { std::string_view(name) });
+        s->data = data;
+    });
+    resume();
+    if (bots)
+        bots->sync();
+}
+
+void ScriptEngine::resume()
+{
+    context->update((int64_t)GET_SETTINGS().playtime);
+}
+
+void ScriptEngine::onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building)
+{
+    context->onBuildingVisit(player, building);
+}
+
+void ScriptEngine::onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item)
+{
+    context->onItemAdded(player, item);
+}
+
+void ScriptEngine::benchmarkBindings(detail::ModificationPlayer *player, int iterations)
+{
+    if (!player)
+        return;
+    ScriptData data;
+    data.player = player;
+    auto r = context->benchmarkBindings(data, iterations);
+    if (!r.empty())
+        LOG_INFO(logger, r);
+}
+
+void ScriptEngine::onBotBuildingVisit(detail::Mechanoid *m, const detail::ModificationMapBuilding *building)
+{
+    auto &settings = getEngine()->getEngineSettings().scripts;
+    if (language != ScriptLanguage::Lua || settings.bot_threads <= 0)
+        return;
+    if (!bots)
+    {
+        try
+        {
+            bots = std::make_unique<BotScriptExecutor>(root, settings.bot_threads, settings.instruction_budget);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR(logger, "Cannot create bot script executor: " << e.what());
+            return;
+        }
+    }
+    // game thread, results of the previous visit can be applied now
+    bots->sync();
+    bots->push(m, building);
+}
+
+bool ScriptEngine::startTrace(const std::string &name)
+{
+    stopTrace();
+
+    // replay needs the state the calls were made in
+    // snapshots are kept apart from user saves, the saves list does not look into subdirectories
+    auto snapshot = "Traces/" + name;
+    std::error_code ec;
+    fs::create_directories(path(getEngine()->getSettings().dirs.saves.c_str()) / "Traces", ec);
+    if (!getEngine()->save(String(snapshot)))
+    {
+        LOG_ERROR(logger, "Cannot save the game for script trace '" << name << "'");
+        return false;
+    }
+    try
+    {
+        traceWriter = std::make_unique<ScriptTraceWriter>(traceDir / (name + ".p4trace"), snapshot);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(logger, "Cannot start script trace: " << e.what());
+        return false;
+    }
+    trace = traceWriter.get();
+    context->setTrace(traceWriter.get());
+    LOG_INFO(logger, "Script trace started: " << name);
+    return true;
+}
+
+void ScriptEngine::stopTrace()
+{
+    if (!traceWriter)
+        return;
+    LOG_INFO(logger, "Script trace stopped, calls = " << traceWriter->getCallCount());
+    context->setTrace(nullptr);
+    trace = nullptr;
+    traceWriter.reset();
+}
+
+static ScriptArgument to_argument(const TraceValue &v)
+{
+    if (auto b = std::get_if<bool>(&v))
+        return *b;
+    if (auto s = std::get_if<std::string>(&v))
+        return std::string_view(*s);
+    if (auto d = std::get_if<double>(&v))
+    {
+        // keep lua integers integers
+        if (*d == (double)(int64_t)*d)
+            return (int64_t)*d;
+        return *d;
+    }
+    // engine never passes nil, keep argument positions
+    return false;
+}
+
+bool ScriptEngine::replayTrace(const path &fn)
+{
+    if (traceWriter)
+    {
+        LOG_ERROR(logger, "Cannot replay a script trace while recording one");
+        return false;
+    }
+
+    std::unique_ptr<ScriptTraceReader> reader;
+    try
+    {
+        reader = std::make_unique<ScriptTraceReader>(fn);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(logger, "Cannot read script trace: " << e.what());
+        return false;
+    }
+
+    LOG_INFO(logger, "Replaying script trace " << fn.string() << ", snapshot = " << reader->getSnapshot());
+
+    auto m = getEngine()->getCurrentModification();
+    auto &playtime = GET_SETTINGS().playtime;
+    auto game_playtime = playtime;
+    ScriptTraceChecker checker;
+    trace = &checker;
+
+    size_t calls = 0, failed = 0, mismatched = 0;
+    int64_t recorded_ns = 0, replay_ns = 0;
+    std::vector<ScriptArgument> args;
+    for (auto &c : reader->getCalls())
+    {
+        // nested calls are made again by the outer ones
+        if (c.depth > 0)
+            continue;
+
+        args.clear();
+        for (auto &a : c.args)
+            args.push_back(to_argument(a));
+
+        auto s = getScript(c.script);
+        s->data.script = s;
+        s->data.player = c.player >= 0 && c.player < (int64_t)m->players.size() ? m->players[c.player] : nullptr;
+        s->data.building = c.building.empty() ? nullptr
+            : (detail::ModificationMapBuilding *)references.find(ScriptReferences::Type::Building, c.building);
+        // timers compare with the playtime of the call
+        playtime = (std::remove_reference_t<decltype(playtime)>)c.playtime;
+
+        checker.expect(c.queries);
+        auto errors = getCallStats().errors;
+        auto start = std::chrono::steady_clock::now();
+        s->invoke(c.function, args);
+        auto t = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        auto ok = getCallStats().errors == errors;
+
+        calls++;
+        failed += !ok;
+        mismatched += checker.getMismatches() != 0;
+        recorded_ns += c.time_ns;
+        replay_ns += t;
+        LOG_INFO(logger, "    " << c.script << ":" << c.function
+            << ": recorded = " << c.time_ns / 1000.0 << " us, replay = " << t / 1000.0 << " us"
+            << (ok == c.ok ? "" : ok ? ", succeeded" : ", failed")
+            << (checker.getMismatches() ? ", query mismatches = " + std::to_string(checker.getMismatches()) : ""));
+    }
+    trace = nullptr;
+    playtime = game_playtime;
+
+    LOG_INFO(logger, "Script trace replayed: calls = " << calls << ", failed = " << failed
+        << ", diverged = " << mismatched << ", recorded = " << recorded_ns / 1e6
+        << " ms, replay = " << replay_ns / 1e6 << " ms");
+    return true;
+}
+
+ScriptCallStats ScriptEngine::getCallStats() const
+{
+    return context->getCallStats();
+}
+
+void ScriptEngine::logStats() const
+{
+    auto c = getCallStats();
+    LOG_DEBUG(logger, "Script calls: " << c.calls << ", aborted = " << c.aborted << ", errors = " << c.errors
+        << ", max time = " << c.max_time_ms << " ms, waiting = " << c.waiting);
+    auto s = getMemoryStats();
+    LOG_DEBUG(logger, "Script memory: used = " << s.used << ", peak = " << s.peak << ", limit = " << s.limit
+        << ", pools = " << s.reserved << " (free " << s.pooled << ")"
+        << ", allocations = " << s.allocations << ", failures = " << s.failures);
+    for (auto &[n, m] : getScriptMemoryUsage())
+        LOG_DEBUG(logger, "    " << m << " " << n);
+}
+
+std::unique_ptr<Script> ScriptEngine::createScript(const path &fn) const
+{
+    LOG_TRACE(logger, "Creating '" << str(language).toString() << "' script executor on file: " << fn.string());
+
+    std::unique_ptr<Script> script;
+    try
+    {
+        script = context->createScript();
+    }
+    catch (const std::exception &e)
     {
         LOG_ERROR(logger, "Cannot load script: " << fn.string());
         script = std::make_unique<Script>();
     }
 
-    // load common file, then load concrete file
-    script->loadFile(root / "common");
     script->loadFile(fn);
 
-    scripts[fn.string()] = std::move(script);
-    return scripts[fn.string()].get();
+    return script;
 }
 
-void Script::OnEnterBuilding()
+const char *getEntryPointName(ScriptEntryPoint ep)
+{
+    switch (ep)
+    {
+    case ScriptEntryPoint::OnEnterBuilding:
+        return "OnEnterBuilding";
+    case ScriptEntryPoint::RegisterQuests:
+        return "RegisterQuests";
+    }
+    return "";
+}
+
+void Script::OnEnterBuilding()
 {
-    call("OnEnterBuilding");
+    call(ScriptEntryPoint::OnEnterBuilding);
 }
 
 void Script::RegisterQuests()
 {
-    call("RegisterQuests");
+    call(ScriptEntryPoint::RegisterQuests);
 }
 
 } // namespace polygon4
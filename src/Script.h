@@ -18,14 +18,24 @@
 
 #pragma once
 
+#include <initializer_list>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 #include <Polygon4/DataManager/Types.h>
 
 #include "Common.h"
+#include "ScriptAllocator.h"
+#include "ScriptBots.h"
 #include "ScriptAPI.h"
+#include "ScriptReferences.h"
+#include "ScriptTimers.h"
+#include "ScriptTrace.h"
+#include "ScriptVariables.h"
+#include "ScriptWatcher.h"
 
 namespace polygon4
 {
@@ -35,6 +45,35 @@ using detail::ScriptLanguage;
 using FunctionName = String;
 using ScriptParameters = std::vector<String>;
 
+// arguments for allocation free calls
+using ScriptArgument = std::variant<std::string_view, int64_t, double, bool>;
+using ScriptArguments = std::initializer_list<ScriptArgument>;
+
+// functions resolved once at load time
+enum class ScriptEntryPoint
+{
+    OnEnterBuilding,
+    RegisterQuests,
+
+    Max
+};
+
+const char *getEntryPointName(ScriptEntryPoint ep);
+
+struct ScriptCallStats
+{
+    uint64_t calls = 0;
+    // calls aborted by instruction or time budget
+    uint64_t aborted = 0;
+    // calls and resumed coroutines failed with an error, aborted ones included
+    uint64_t errors = 0;
+    // slowest call
+    double max_time_ms = 0;
+    // coroutines waiting for events
+    size_t waiting = 0;
+};
+
+class LuaBytecodeCache;
 class ScriptEngine;
 
 class Script
@@ -50,29 +89,157 @@ public:
 
     virtual std::string getScriptExtension() const { return std::string(); }
 
-    virtual void loadFile(const path &p);
+    // name passed to ScriptEngine::getScript()
+    const std::string &getName() const { return name; }
+
+    virtual bool loadFile(const path &p);
+
+    // true if any of loaded files was changed on disk
+    bool isOutdated() const;
+
+    // approximate bytes allocated while loading and running this script
+    virtual size_t getMemoryUsage() const { return 0; }
 
 public: /* API */
     virtual void call(const FunctionName &fn, const ScriptParameters &params = ScriptParameters()) {}
+    virtual void call(ScriptEntryPoint ep, ScriptArguments args = {}) {}
+    virtual void invoke(std::string_view fn, ScriptArguments args = {}) {}
+    // arguments built at runtime, used by trace replay
+    virtual void invoke(std::string_view fn, const std::vector<ScriptArgument> &args) {}
 
     void OnEnterBuilding();
     void RegisterQuests();
 
 private:
+    std::string name;
+    std::vector<std::pair<path, fs::file_time_type>> files;
+
     virtual bool loadScriptFile(const path &p) { return false; }
+
+    friend class ScriptEngine;
+};
+
+// language vm shared by all scripts of the engine
+class ScriptContext
+{
+public:
+    virtual ~ScriptContext() = default;
+
+    // common script defines globals visible to all other scripts
+    virtual std::unique_ptr<Script> createCommonScript() { return std::make_unique<Script>(); }
+    virtual std::unique_ptr<Script> createScript() { return std::make_unique<Script>(); }
+
+    virtual ScriptMemoryStats getMemoryStats() const { return {}; }
+    virtual ScriptCallStats getCallStats() const { return {}; }
+
+    // per call limits, 0 - unlimited
+    virtual void setBudget(uint64_t instructions, int time_ms) {}
+
+    // waiting scripts
+    virtual void update(int64_t playtime) {}
+    virtual void onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building) {}
+    virtual void onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item) {}
+
+    virtual void startProfiling(int sample_interval) {}
+    // writes collected profile into dir
+    virtual void stopProfiling(const path &dir) {}
+
+    // compares generic and fast binding paths, returns a report
+    virtual std::string benchmarkBindings(ScriptData &data, int iterations) { return {}; }
+
+    // calls are recorded while a trace is set
+    void setTrace(ScriptTraceWriter *t) { trace = t; }
+    ScriptTraceWriter *getTrace() const { return trace; }
+
+protected:
+    ScriptTraceWriter *trace = nullptr;
 };
 
 class ScriptEngine
 {
 public:
-    ScriptEngine(const path &p, ScriptLanguage language);
+    ScriptEngine(const path &p, ScriptLanguage language, const detail::Modification *modification = nullptr);
+    ~ScriptEngine();
 
+    // returns cached script, it is reloaded only if its files were changed
     Script *getScript(const std::string &name);
+    // player building visit, reloads changed scripts and returns the building script
+    // the building menu calls the script later, so it is not replaced until the next visit
+    Script *beginVisit(const std::string &name);
+    void preloadScript(const std::string &name);
+
+    static std::string getBuildingScriptName(const detail::ModificationMapBuilding *b);
+
+    ScriptMemoryStats getMemoryStats() const;
+    ScriptCallStats getCallStats() const;
+    // loaded scripts, largest first
+    std::vector<std::pair<std::string, size_t>> getScriptMemoryUsage() const;
+    void logStats() const;
+
+    ScriptTimers &getTimers() { return timers; }
+    ScriptVariables &getVariables() { return variables; }
+    ScriptReferences &getReferences() { return references; }
+
+    // called every frame by Modification::update()
+    // reloads changed scripts, fires timers and resumes scripts waiting for time or events
+    void update();
+    // resumes scripts whose events have fired, e.g. during a building visit
+    void resume();
+    void onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building);
+    void onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item);
+    // bot scripts run on worker threads, their changes are applied every frame in update()
+    // and before the next bot visit, so a finished bot is not skipped as busy
+    void onBotBuildingVisit(detail::Mechanoid *m, const detail::ModificationMapBuilding *building);
+
+    // profile is saved when profiling is stopped or scripts are reloaded
+    void setProfiling(bool enable);
+    bool isProfiling() const { return profiling; }
+
+    // measures script api calls on behalf of the player and logs the result
+    void benchmarkBindings(detail::ModificationPlayer *player, int iterations = 100000);
+
+    // records script calls and query results into <mod>/Traces/<name>.p4trace
+    // the game is saved as Traces/<name> in the saves directory first, replay starts from that save
+    bool startTrace(const std::string &name);
+    void stopTrace();
+    bool isTracing() const { return !!traceWriter; }
+    // runs recorded calls against the loaded game and logs recorded and replay times
+    // the snapshot of the trace must be loaded before, Engine::replayScriptTrace() does both
+    bool replayTrace(const path &fn);
+    // ScriptData queries report their results here
+    void traceQuery(std::string_view name, std::string_view arg, double result)
+    {
+        if (trace)
+            trace->onQuery(name, arg, result);
+    }
 
 private:
     path root;
+    path profileDir;
+    path traceDir;
     ScriptLanguage language;
+    bool profiling = false;
+    // order matters: scripts must be destroyed before their context
+    std::unique_ptr<LuaBytecodeCache> bytecodeCache;
+    std::unique_ptr<ScriptContext> context;
+    std::unique_ptr<Script> common;
     std::unordered_map<std::string, std::unique_ptr<Script>> scripts;
+    ScriptVariables variables;
+    ScriptTimers timers;
+    ScriptReferences references;
+    std::unique_ptr<BotScriptExecutor> bots;
+    std::unique_ptr<ScriptWatcher> watcher;
+    std::unique_ptr<ScriptTraceWriter> traceWriter;
+    // writer while recording, checker while replaying
+    ScriptTrace *trace = nullptr;
+    // script of the current building visit and its changes waiting for the next visit
+    Script *visiting = nullptr;
+    std::vector<path> deferredChanges;
+
+    void createContext();
+    void reloadChanged();
+    void scanReferences(const Script &s);
+    std::unique_ptr<Script> createScript(const path &fn) const;
 };
 
 } // namespace polygon4
@@ -18,6 +18,7 @@
 
 #include "ScriptAPI.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include <Polygon4/BuildingMenu.h>
@@ -36,35 +37,48 @@ namespace polygon4
 namespace script
 {
 
-String &getScreenText()
+ScreenTextBuffer &getScreenText()
 {
-    return GET_BUILDING_MENU()->getText();
+    return GET_BUILDING_MENU()->getTextBuffer();
+}
+
+static ScriptEngine *getScriptEngine()
+{
+    auto m = getEngine()->getCurrentModification();
+    return m ? m->getScriptEngine() : nullptr;
+}
+
+// ids are resolved through the engine cache, scripts were checked on load
+// and unknown ids are reported only once
+static detail::IObjectBase *find_reference(ScriptReferences::Type type, const std::string &id)
+{
+    if (auto se = getScriptEngine())
+        return se->getReferences().find(type, id);
+    ScriptReferences refs;
+    return refs.find(type, id);
+}
+
+// results of game state queries go to the active script trace
+template <class T>
+static T trace_query(const char *name, std::string_view arg, T result)
+{
+    if (auto se = getScriptEngine())
+        se->traceQuery(name, arg, (double)result);
+    return result;
 }
 
 polygon4::detail::Message *get_message_by_id(const std::string &message_id)
 {
-    auto &v = getEngine()->getMessages();
-    auto i = v.find(message_id);
-    if (i == v.end())
-    {
-        LOG_ERROR(logger, "Message '" << message_id << "' was not found");
-        return nullptr;
-    }
-    return (polygon4::detail::Message*)i->second;
+    return (polygon4::detail::Message*)find_reference(ScriptReferences::Type::Message, message_id);
 }
 
 void ScriptData::AddItem(const std::string &oname, int quantity)
 {
     LOG_TRACE(logger, "AddItem(" << oname << ", n = " << quantity << ")");
 
-    auto &objs = getEngine()->getItems();
-    auto i = objs.find(oname);
-    if (i == objs.end())
-    {
-        LOG_ERROR(logger, "Item '" << oname << "' was not found");
+    auto o = find_reference(ScriptReferences::Type::Item, oname);
+    if (!o)
         return;
-    }
-    auto o = i->second;
     auto conf = player->mechanoid->getConfiguration();
     conf->addItem(o, quantity);
     BM_TEXT_ADD_ITEM(o, quantity);
@@ -74,30 +88,20 @@ bool ScriptData::HasItem(const std::string &oname, int quantity)
 {
     LOG_TRACE(logger, "HasItem(" << oname << ", n = " << quantity << ")");
 
-    auto &objs = getEngine()->getItems();
-    auto i = objs.find(oname);
-    if (i == objs.end())
-    {
-        LOG_ERROR(logger, "Item '" << oname << "' was not found");
-        return false;
-    }
-    auto o = i->second;
+    auto o = find_reference(ScriptReferences::Type::Item, oname);
+    if (!o)
+        return trace_query("HasItem", oname, false);
     auto conf = player->mechanoid->getConfiguration();
-    return conf->hasItem(o, quantity);
+    return trace_query("HasItem", oname, conf->hasItem(o, quantity));
 }
 
 bool ScriptData::RemoveItem(const std::string &oname, int quantity)
 {
     LOG_TRACE(logger, "RemoveItem(" << oname << ", n = " << quantity << ")");
 
-    auto &objs = getEngine()->getItems();
-    auto i = objs.find(oname);
-    if (i == objs.end())
-    {
-        LOG_ERROR(logger, "Item '" << oname << "' was not found");
+    auto o = find_reference(ScriptReferences::Type::Item, oname);
+    if (!o)
         return false;
-    }
-    auto o = i->second;
     auto conf = player->mechanoid->getConfiguration();
     return conf->removeItem(o, quantity);
 }
@@ -119,7 +123,7 @@ bool ScriptData::HasMoney(float amount) const
 
 float ScriptData::GetMoney() const
 {
-    return player->mechanoid->getMoney();
+    return trace_query("GetMoney", {}, player->mechanoid->getMoney());
 }
 
 void ScriptData::SetMoney(float m)
@@ -145,7 +149,7 @@ float ScriptData::GetRating(RatingType type) const
 {
     LOG_TRACE(logger, "GetRating(), type: " << static_cast<int>(type));
 
-    return player->mechanoid->getRating((polygon4::detail::RatingType)type);
+    return trace_query("GetRating", std::to_string((int)type), player->mechanoid->getRating((polygon4::detail::RatingType)type));
 }
 
 void ScriptData::SetRating(float amount, RatingType type)
@@ -159,7 +163,7 @@ int ScriptData::GetRatingLevel(RatingType type) const
 {
     LOG_TRACE(logger, "GetRatingLevel(), type: " << static_cast<int>(type));
 
-    return player->mechanoid->getRatingLevel((polygon4::detail::RatingType)type);
+    return trace_query("GetRatingLevel", std::to_string((int)type), player->mechanoid->getRatingLevel((polygon4::detail::RatingType)type));
 }
 
 bool ScriptData::HasRatingLevel(int level, RatingType type) const
@@ -197,6 +201,7 @@ void ScriptData::MarkJournalRecord(const std::string &message_id, QuestRecord ty
     {
         auto &r = player->records[message_id];
         r->type = (detail::QuestRecordType)type;
+        GET_BUILDING_MENU()->invalidate(BuildingMenu::SectionJournal);
         return;
     }
 
@@ -207,6 +212,7 @@ void ScriptData::MarkJournalRecord(const std::string &message_id, QuestRecord ty
     r->type = (detail::QuestRecordType)type;
     r->time = getEngine()->getSettings().playtime;
     player->records.insert_to_data(r);
+    GET_BUILDING_MENU()->invalidate(BuildingMenu::SectionJournal);
 }
 
 void ScriptData::MarkJournalRecordCompleted(const std::string &message_id)
@@ -216,93 +222,127 @@ void ScriptData::MarkJournalRecordCompleted(const std::string &message_id)
     MarkJournalRecord(message_id, QuestRecord::Completed);
 }
 
-int ScriptData::GetVar(const std::string &var)
+// variables through the engine index, null without a running game
+static ScriptVariables *get_variables()
 {
-    LOG_TRACE(logger, "GetVar(" << var << ")");
-
-    auto v = std::find_if(player->variables.begin(), player->variables.end(), [&var](const auto &v)
-    {
-        return v->key == var;
-    });
-    if (v != player->variables.end())
-    {
-        LOG_TRACE(logger, "GetVar(val = " << (*v)->value_int << ")");
-        return (*v)->value_int;
-    }
-    LOG_TRACE(logger, "GetVar(val = " << 0 << ")");
-    return 0;
+    auto se = getScriptEngine();
+    return se ? &se->getVariables() : nullptr;
 }
 
-void ScriptData::SetVar(const std::string &var, int i)
+// without a running game player variables are scanned as before the index
+static detail::ScriptVariable *find_variable(detail::ModificationPlayer *player, const std::string &var)
 {
-    LOG_TRACE(logger, "SetVar(" << var << ", val = " << i << ")");
-
+    if (auto vars = get_variables())
+        return vars->find(player, var);
     auto v = std::find_if(player->variables.begin(), player->variables.end(), [&var](const auto &v)
     {
         return v->key == var;
     });
-    if (v != player->variables.end())
-    {
-        (*v)->value_int = i;
-        return;
-    }
+    if (v == player->variables.end())
+        return nullptr;
+    return *v;
+}
 
+static detail::ScriptVariable *get_variable(detail::ModificationPlayer *player, const std::string &var)
+{
+    if (auto vars = get_variables())
+        return vars->get(player, var);
+    if (auto v = find_variable(player, var))
+        return v;
     auto sv = GET_STORAGE()->scriptVariables.createAtEnd();
     sv->player = player;
     sv->key = var;
-    sv->value_int = i;
     player->variables.insert(sv);
+    return sv;
 }
 
-void ScriptData::SetVar(const std::string &var, const std::string &val)
+static void erase_variable(detail::ModificationPlayer *player, const std::string &var)
 {
-    LOG_TRACE(logger, "SetVar(" << var << ", val = " << val << ")");
-
+    if (auto vars = get_variables())
+    {
+        vars->erase(player, var);
+        return;
+    }
     auto v = std::find_if(player->variables.begin(), player->variables.end(), [&var](const auto &v)
     {
         return v->key == var;
     });
     if (v != player->variables.end())
+        player->variables.erase(v);
+}
+
+int ScriptData::GetVar(const std::string &var)
+{
+    LOG_TRACE(logger, "GetVar(" << var << ")");
+
+    if (auto v = find_variable(player, var))
     {
-        (*v)->value_text = val;
-        return;
+        LOG_TRACE(logger, "GetVar(val = " << v->value_int << ")");
+        return trace_query("GetVar", var, v->value_int);
     }
+    LOG_TRACE(logger, "GetVar(val = " << 0 << ")");
+    return trace_query("GetVar", var, 0);
+}
 
-    auto sv = GET_STORAGE()->scriptVariables.createAtEnd();
-    sv->player = player;
-    sv->key = var;
-    sv->value_text = val;
-    player->variables.insert(sv);
+void ScriptData::SetVar(const std::string &var, int i)
+{
+    LOG_TRACE(logger, "SetVar(" << var << ", val = " << i << ")");
+
+    get_variable(player, var)->value_int = i;
+}
+
+void ScriptData::SetVar(const std::string &var, const std::string &val)
+{
+    LOG_TRACE(logger, "SetVar(" << var << ", val = " << val << ")");
+
+    get_variable(player, var)->value_text = val;
 }
 
 void ScriptData::UnsetVar(const std::string &var)
 {
     LOG_TRACE(logger, "UnsetVar(" << var << ")");
 
-    auto v = std::find_if(player->variables.begin(), player->variables.end(), [&var](const auto &v)
-    {
-        return v->key == var;
-    });
-    if (v == player->variables.end())
-        return;
-    player->variables.erase(v);
+    erase_variable(player, var);
 }
 
 bool ScriptData::CheckVar(const std::string &var)
 {
     LOG_TRACE(logger, "CheckVar(" << var << ")");
 
-    auto v = std::find_if(player->variables.begin(), player->variables.end(), [&var](const auto &v)
-    {
-        return v->key == var;
-    });
-    if (v != player->variables.end())
+    if (find_variable(player, var))
     {
         LOG_TRACE(logger, "CheckVar(true)");
-        return true;
+        return trace_query("CheckVar", var, true);
     }
     LOG_TRACE(logger, "CheckVar(false)");
-    return false;
+    return trace_query("CheckVar", var, false);
+}
+
+std::vector<int> ScriptData::GetVars(const std::vector<std::string> &vars)
+{
+    LOG_TRACE(logger, "GetVars(n = " << vars.size() << ")");
+
+    std::vector<int> values;
+    values.reserve(vars.size());
+    for (auto &var : vars)
+    {
+        auto v = find_variable(player, var);
+        values.push_back(trace_query("GetVar", var, v ? v->value_int : 0));
+    }
+    return values;
+}
+
+void ScriptData::SetVars(const std::vector<std::string> &vars, const std::vector<int> &values)
+{
+    LOG_TRACE(logger, "SetVars(n = " << vars.size() << ")");
+
+    if (vars.size() != values.size())
+    {
+        LOG_ERROR(logger, "SetVars(): " << vars.size() << " names, but " << values.size() << " values");
+        return;
+    }
+    for (size_t i = 0; i < vars.size(); i++)
+        get_variable(player, vars[i])->value_int = values[i];
 }
 
 bool ScriptData::RunOnce(const std::string &var)
@@ -337,16 +377,20 @@ void ScriptData::SetPointer(const std::string &bld)
 {
     LOG_TRACE(logger, "SetPointer(" << bld << ")");
 
+    auto b = (detail::ModificationMapBuilding *)find_reference(ScriptReferences::Type::Building, bld);
+    if (!b)
+        return;
+
     // mark building as known
-    auto iter = player->buildings.find_if([bld](const auto &vb)
+    auto iter = player->buildings.find_if([b](const auto &vb)
     {
-        return vb->building->text_id == bld;
+        return vb->building.get() == b;
     });
     if (iter == player->buildings.end())
     {
         auto vb = GET_STORAGE()->modificationPlayerBuildings.createAtEnd();
         vb->player = player;
-        vb->building = building;
+        vb->building = b;
         vb->know_location = true;
         player->buildings.insert(vb);
     }
@@ -360,12 +404,13 @@ bool ScriptData::IsDamaged(float percent) const
 {
     LOG_TRACE(logger, "IsDamaged(" << percent << "%)");
 
+    auto arg = std::to_string(percent);
     percent /= 50.0f;
     auto c = player->mechanoid->getConfiguration();
     auto p = 1.0f - c->getCurrentArmor() / c->getMaxArmor();
     if (percent == 0.0f && p == 0.0f)
-        return false;
-    return p >= percent;
+        return trace_query("IsDamaged", arg, false);
+    return trace_query("IsDamaged", arg, p >= percent);
 }
 
 bool ScriptData::IsDamagedHigh() const
@@ -389,12 +434,9 @@ void ScriptData::RegisterQuest(const std::string &name)
     if (next_quest || CheckVar(name + ".COMPLETED"))
         return; // already completed
 
-    auto o = getEngine()->getObjects()[name];
+    auto o = find_reference(ScriptReferences::Type::Object, name);
     if (!o)
-    {
-        LOG_ERROR(logger, "Quest '" << name << "' not found");
         return; // no such quest
-    }
 
     next_quest = (polygon4::detail::Message*)o;
 }
@@ -456,7 +498,13 @@ void ScriptData::StartTimerMs(const std::string &name, int ms)
 {
     LOG_ERROR(logger, "StartTimerMs(" << name << ", ms = " << ms << ")");
 
-    SetVar(name, GET_SETTINGS().playtime + ms);
+    auto se = getScriptEngine();
+    if (!se)
+    {
+        SetVar(name, GET_SETTINGS().playtime + ms);
+        return;
+    }
+    se->getTimers().start(player, name, GET_SETTINGS().playtime + ms);
 }
 
 void ScriptData::StartTimerMin(const std::string &name, int min)
@@ -466,10 +514,35 @@ void ScriptData::StartTimerMin(const std::string &name, int min)
     StartTimer(name, min * 60);
 }
 
+void ScriptData::StartTimerCallback(const std::string &name, int seconds, const std::string &callback)
+{
+    LOG_TRACE(logger, "StartTimerCallback(" << name << ", sec = " << seconds << ", callback = " << callback << ")");
+
+    auto se = getScriptEngine();
+    if (!se || !script)
+    {
+        LOG_ERROR(logger, "Cannot start timer '" << name << "' without a script");
+        return;
+    }
+    se->getTimers().start(player, name, GET_SETTINGS().playtime + seconds * 1000, script->getName(), callback);
+}
+
+void ScriptData::StopTimer(const std::string &name)
+{
+    LOG_TRACE(logger, "StopTimer(" << name << ")");
+
+    if (auto se = getScriptEngine())
+        se->getTimers().stop(player, name);
+    else
+        UnsetVar(name);
+}
+
 bool ScriptData::IsTimerExpired(const std::string &name)
 {
     LOG_ERROR(logger, "IsTimerExpired(" << name << ")");
 
+    // the variable is checked, not the timer service:
+    // scripts may overwrite or unset it with SetVar() and UnsetVar()
     auto v = GetVar(name);
     if (v == 0)
         return false;
@@ -480,18 +553,14 @@ void AddText(const std::string &text)
 {
     LOG_TRACE(logger, "AddText(" << text << ")");
 
-    auto &t = getScreenText();
-    t += String(text);
+    getScreenText().append(String(text));
 }
 
 void AddTextOnce(const std::string &text)
 {
     LOG_TRACE(logger, "AddTextOnce(" << text << ")");
 
-    auto &t = getScreenText();
-    auto s = String(text);
-    auto pos = t.rfind(s);
-    if (pos == t.npos || pos + s.size() != t.size())
+    if (!getScreenText().endsWith(String(text)))
         AddText(text);
 }
 
@@ -501,7 +570,7 @@ void ShowText(const std::string &text)
 
     auto &t = getScreenText();
     t.clear();
-    t += String(text);
+    t.append(String(text));
 }
 
 void ClearText()
@@ -568,7 +637,7 @@ ScreenText ScreenText::operator+(const std::string &s)
     LOG_TRACE(logger, "ScreenText::operator+(" << s << ")");
 
     if (screenText)
-        getScreenText() += String(s);
+        getScreenText().append(String(s));
     return *this;
 }
 
@@ -18,12 +18,16 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <Polygon4/DataManager/Types.h>
 
 namespace polygon4
 {
 
 class Script;
+class ScreenTextBuffer;
 
 namespace script
 {
@@ -85,6 +89,9 @@ struct ScriptData
     void UnsetVar(const std::string &var);
     bool CheckVar(const std::string &var);
     bool RunOnce(const std::string &var);
+    // bulk versions for scripts touching many variables
+    std::vector<int> GetVars(const std::vector<std::string> &vars);
+    void SetVars(const std::vector<std::string> &vars, const std::vector<int> &values);
 
     // name
     std::string GetName() const;
@@ -113,6 +120,9 @@ struct ScriptData
     void StartTimer(const std::string &name, int seconds);
     void StartTimerMs(const std::string &name, int ms);
     void StartTimerMin(const std::string &name, int min);
+    // callback(data, name) of the current script is called when the timer expires
+    void StartTimerCallback(const std::string &name, int seconds, const std::string &callback);
+    void StopTimer(const std::string &name);
     bool IsTimerExpired(const std::string &name);
 };
 
@@ -122,7 +132,7 @@ struct ScreenText
     ScreenText __concat__(const std::string &s);
 
 #ifndef SWIG
-    String *screenText = nullptr;
+    ScreenTextBuffer *screenText = nullptr;
 #endif
 };
 
@@ -2,6 +2,10 @@
 
 %include <stdint.i>
 %include <std_string.i>
+%include <std_vector.i>
+
+%template(StringVector) std::vector<std::string>;
+%template(IntVector) std::vector<int>;
 
 %{
 #include "ScriptAPI.h"
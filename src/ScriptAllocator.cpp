@@ -0,0 +1,150 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptAllocator.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+namespace polygon4
+{
+
+LuaAllocator::LuaAllocator(size_t limit)
+{
+    stats.limit = limit;
+}
+
+LuaAllocator::~LuaAllocator()
+{
+    for (auto c : chunks)
+        free(c);
+}
+
+void *LuaAllocator::alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    auto a = (LuaAllocator *)ud;
+    // for new blocks osize holds the lua object type
+    if (!ptr)
+        osize = 0;
+
+    auto &s = a->stats;
+    if (nsize == 0)
+    {
+        if (ptr)
+        {
+            a->deallocate(ptr, osize);
+            s.used -= osize;
+        }
+        return nullptr;
+    }
+
+    // shrinking must never fail
+    if (s.limit && nsize > osize && s.used - osize + nsize > s.limit)
+    {
+        s.failures++;
+        return nullptr;
+    }
+
+    auto p = a->reallocate(ptr, osize, nsize);
+    if (!p)
+    {
+        s.failures++;
+        return nullptr;
+    }
+    s.used = s.used - osize + nsize;
+    s.peak = std::max(s.peak, s.used);
+    return p;
+}
+
+void *LuaAllocator::reallocate(void *ptr, size_t osize, size_t nsize)
+{
+    if (!ptr)
+        return allocate(nsize);
+
+    // block already fits
+    if (isPooled(osize) && isPooled(nsize) && getClass(osize) == getClass(nsize))
+        return ptr;
+
+    if (!isPooled(osize) && !isPooled(nsize))
+    {
+        stats.allocations++;
+        return realloc(ptr, nsize);
+    }
+
+    auto p = allocate(nsize);
+    if (!p)
+        return nullptr;
+    memcpy(p, ptr, std::min(osize, nsize));
+    deallocate(ptr, osize);
+    return p;
+}
+
+void *LuaAllocator::allocate(size_t n)
+{
+    stats.allocations++;
+    if (!isPooled(n))
+        return malloc(n);
+
+    auto cls = getClass(n);
+    if (!free_lists[cls] && !refill(cls))
+        return nullptr;
+    auto b = free_lists[cls];
+    free_lists[cls] = b->next;
+    stats.pooled -= getClassSize(cls);
+    return b;
+}
+
+void LuaAllocator::deallocate(void *p, size_t n)
+{
+    if (!isPooled(n))
+    {
+        free(p);
+        return;
+    }
+
+    auto cls = getClass(n);
+    auto b = (FreeBlock *)p;
+    b->next = free_lists[cls];
+    free_lists[cls] = b;
+    stats.pooled += getClassSize(cls);
+}
+
+bool LuaAllocator::refill(size_t cls)
+{
+    // malloc alignment is kept because class sizes are multiples of 16
+    auto c = (char *)malloc(chunk_size);
+    if (!c)
+        return false;
+    chunks.push_back(c);
+    stats.reserved += chunk_size;
+
+    auto size = getClassSize(cls);
+    auto n = chunk_size / size;
+    for (size_t i = 0; i < n; i++)
+    {
+        auto b = (FreeBlock *)(c + i * size);
+        b->next = free_lists[cls];
+        free_lists[cls] = b;
+    }
+    stats.pooled += n * size;
+    return true;
+}
+
+} // namespace polygon4
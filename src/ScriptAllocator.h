@@ -0,0 +1,87 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace polygon4
+{
+
+struct ScriptMemoryStats
+{
+    // bytes currently held by the vm
+    size_t used = 0;
+    size_t peak = 0;
+    // 0 - unlimited
+    size_t limit = 0;
+    // bytes in pool chunks and how much of it is free
+    size_t reserved = 0;
+    size_t pooled = 0;
+    uint64_t allocations = 0;
+    // requests refused because of the limit
+    uint64_t failures = 0;
+};
+
+// lua_Alloc with free lists for small blocks
+// lua tells the old block size on free and realloc,
+// so blocks need no headers and the pool only keeps one list per size class
+class LuaAllocator
+{
+public:
+    LuaAllocator(size_t limit = 0);
+    LuaAllocator(const LuaAllocator &) = delete;
+    LuaAllocator &operator=(const LuaAllocator &) = delete;
+    ~LuaAllocator();
+
+    // pass as lua_newstate(LuaAllocator::alloc, &allocator)
+    static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+    size_t getUsed() const { return stats.used; }
+    const ScriptMemoryStats &getStats() const { return stats; }
+    void setLimit(size_t limit) { stats.limit = limit; }
+
+private:
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_pooled_size = 256;
+    static constexpr size_t n_classes = max_pooled_size / granularity;
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    FreeBlock *free_lists[n_classes] = {};
+    std::vector<void *> chunks;
+    ScriptMemoryStats stats;
+
+    void *reallocate(void *ptr, size_t osize, size_t nsize);
+    void *allocate(size_t n);
+    void deallocate(void *p, size_t n);
+    bool refill(size_t cls);
+
+    static bool isPooled(size_t n) { return n && n <= max_pooled_size; }
+    static size_t getClass(size_t n) { return (n - 1) / granularity; }
+    static size_t getClassSize(size_t cls) { return (cls + 1) * granularity; }
+};
+
+} // namespace polygon4
@@ -0,0 +1,490 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptBots.h"
+
+#include <stdexcept>
+
+#include <Polygon4/Engine.h>
+#include <Polygon4/Mechanoid.h>
+
+#include "Script.h"
+#include "ScriptLuaCompat.h"
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_bots");
+
+namespace polygon4
+{
+
+static const int rating_types = 4;
+
+static const char worker_key = 0;
+
+class BotScriptExecutor::Worker
+{
+public:
+    Worker(BotScriptExecutor &executor);
+    ~Worker();
+
+    void call(BotVisit &v);
+
+private:
+    struct Script
+    {
+        // registry reference to OnBotEnterBuilding()
+        int fn = LUA_NOREF;
+        fs::file_time_type time;
+        bool loaded = false;
+    };
+
+    BotScriptExecutor &executor;
+    lua_State *L;
+    std::unordered_map<std::string, Script> scripts;
+    BotVisit *visit = nullptr;
+    uint64_t instructions = 0;
+
+    bool load(const path &fn);
+    int getEntryPoint(const std::string &name);
+
+    static Worker &get(lua_State *L);
+    static BotVisit &getVisit(lua_State *L);
+    static detail::IObjectBase *checkItem(lua_State *L, int i);
+    static int checkRatingType(lua_State *L, int i);
+    static void hook(lua_State *L, lua_Debug *ar);
+
+    static int GetMoney(lua_State *L);
+    static int HasMoney(lua_State *L);
+    static int AddMoney(lua_State *L);
+    static int GetRating(lua_State *L);
+    static int AddRating(lua_State *L);
+    static int HasItem(lua_State *L);
+    static int AddItem(lua_State *L);
+    static int RemoveItem(lua_State *L);
+    static int GetBuilding(lua_State *L);
+    static int Log(lua_State *L);
+};
+
+BotScriptExecutor::Worker::Worker(BotScriptExecutor &executor)
+    : executor(executor)
+{
+    static const luaL_Reg functions[] =
+    {
+        { "GetMoney", GetMoney },
+        { "HasMoney", HasMoney },
+        { "AddMoney", AddMoney },
+        { "GetRating", GetRating },
+        { "AddRating", AddRating },
+        { "HasItem", HasItem },
+        { "AddItem", AddItem },
+        { "RemoveItem", RemoveItem },
+        { "GetBuilding", GetBuilding },
+        { "Log", Log },
+        { nullptr, nullptr },
+    };
+
+    L = luaL_newstate();
+    if (!L)
+        throw std::runtime_error("Cannot create lua state");
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &worker_key);
+    luaopen_base(L);
+    lua_newtable(L);
+    luaL_setfuncs(L, functions, 0);
+    lua_setglobal(L, "Bot");
+    if (executor.instruction_budget)
+        lua_sethook(L, hook, LUA_MASKCOUNT, 1000);
+
+    // common script is loaded into globals
+    auto fn = executor.root / "common";
+    std::error_code ec;
+    if (!fs::exists(fn, ec))
+        fn += ".lua";
+    if (load(fn))
+    {
+        instructions = 0;
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+        {
+            LOG_ERROR(logger, "Error in bot common script: " << lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+}
+
+BotScriptExecutor::Worker::~Worker()
+{
+    lua_close(L);
+}
+
+bool BotScriptExecutor::Worker::load(const path &fn)
+{
+    if (luaL_loadfile(L, fn.string().c_str()) == LUA_OK)
+        return true;
+    LOG_ERROR(logger, "Cannot load bot script: " << lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return false;
+}
+
+int BotScriptExecutor::Worker::getEntryPoint(const std::string &name)
+{
+    auto fn = executor.root / name;
+    std::error_code ec;
+    if (!fs::exists(fn, ec))
+        fn += ".lua";
+    auto time = fs::last_write_time(fn, ec);
+
+    // reload changed scripts
+    auto &s = scripts[name];
+    if (s.loaded && s.time == time)
+        return s.fn;
+    luaL_unref(L, LUA_REGISTRYINDEX, s.fn);
+    s.fn = LUA_NOREF;
+    s.time = time;
+    s.loaded = true;
+    if (ec || !load(fn))
+        return LUA_NOREF;
+
+    // setmetatable({}, { __index = _G })
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushglobaltable(L);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_insert(L, -3);
+    set_chunk_env(L);
+
+    // global statements
+    instructions = 0;
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+    {
+        LOG_ERROR(logger, "Error in bot script " << fn.string() << ": " << lua_tostring(L, -1));
+        lua_pop(L, 2);
+        return LUA_NOREF;
+    }
+    lua_getfield(L, -1, "OnBotEnterBuilding");
+    if (lua_isfunction(L, -1))
+        s.fn = luaL_ref(L, LUA_REGISTRYINDEX);
+    else
+        lua_pop(L, 1);
+    lua_pop(L, 1);
+    return s.fn;
+}
+
+void BotScriptExecutor::Worker::call(BotVisit &v)
+{
+    auto fn = getEntryPoint(v.script);
+    if (fn == LUA_NOREF)
+        return;
+
+    visit = &v;
+    instructions = 0;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, fn);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+    {
+        v.error = lua_tostring(L, -1);
+        lua_pop(L, 1);
+    }
+    visit = nullptr;
+}
+
+BotScriptExecutor::Worker &BotScriptExecutor::Worker::get(lua_State *L)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &worker_key);
+    auto w = (Worker *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return *w;
+}
+
+BotVisit &BotScriptExecutor::Worker::getVisit(lua_State *L)
+{
+    auto v = get(L).visit;
+    if (!v)
+        luaL_error(L, "Bot functions can be used only in OnBotEnterBuilding()");
+    return *v;
+}
+
+detail::IObjectBase *BotScriptExecutor::Worker::checkItem(lua_State *L, int i)
+{
+    size_t n;
+    auto s = luaL_checklstring(L, i, &n);
+    auto o = get(L).executor.findItem({ s, n });
+    if (!o)
+        luaL_error(L, "Item '%s' was not found", s);
+    return o;
+}
+
+int BotScriptExecutor::Worker::checkRatingType(lua_State *L, int i)
+{
+    auto t = (int)luaL_optinteger(L, i, 0);
+    if (t < 0 || t >= rating_types)
+        luaL_error(L, "Unknown rating type: %d", t);
+    return t;
+}
+
+void BotScriptExecutor::Worker::hook(lua_State *L, lua_Debug *ar)
+{
+    auto &w = get(L);
+    w.instructions += 1000;
+    if (w.instructions > w.executor.instruction_budget)
+        luaL_error(L, "Bot script is over the instruction budget");
+}
+
+int BotScriptExecutor::Worker::GetMoney(lua_State *L)
+{
+    lua_pushnumber(L, getVisit(L).money);
+    return 1;
+}
+
+int BotScriptExecutor::Worker::HasMoney(lua_State *L)
+{
+    auto &v = getVisit(L);
+    lua_pushboolean(L, v.money >= luaL_checknumber(L, 1));
+    return 1;
+}
+
+int BotScriptExecutor::Worker::AddMoney(lua_State *L)
+{
+    auto &v = getVisit(L);
+    auto m = (float)luaL_checknumber(L, 1);
+    v.money += m;
+    v.commands.push_back({ BotCommand::Type::AddMoney, m });
+    return 0;
+}
+
+int BotScriptExecutor::Worker::GetRating(lua_State *L)
+{
+    auto &v = getVisit(L);
+    lua_pushnumber(L, v.ratings[checkRatingType(L, 1)]);
+    return 1;
+}
+
+int BotScriptExecutor::Worker::AddRating(lua_State *L)
+{
+    auto &v = getVisit(L);
+    auto r = (float)luaL_checknumber(L, 1);
+    auto t = checkRatingType(L, 2);
+    // same clamp as Mechanoid::setRating()
+    v.ratings[t] += r;
+    if (v.ratings[t] < 1)
+        v.ratings[t] = 1;
+    v.commands.push_back({ BotCommand::Type::AddRating, r, t });
+    return 0;
+}
+
+int BotScriptExecutor::Worker::HasItem(lua_State *L)
+{
+    auto &v = getVisit(L);
+    auto o = checkItem(L, 1);
+    auto q = (int)luaL_optinteger(L, 2, 1);
+    auto i = v.items.find(o);
+    lua_pushboolean(L, i != v.items.end() && i->second >= q);
+    return 1;
+}
+
+int BotScriptExecutor::Worker::AddItem(lua_State *L)
+{
+    auto &v = getVisit(L);
+    auto o = checkItem(L, 1);
+    auto q = (int)luaL_optinteger(L, 2, 1);
+    v.items[o] += q;
+    v.commands.push_back({ BotCommand::Type::AddItem, 0.0f, 0, o, q });
+    return 0;
+}
+
+int BotScriptExecutor::Worker::RemoveItem(lua_State *L)
+{
+    auto &v = getVisit(L);
+    auto o = checkItem(L, 1);
+    auto q = (int)luaL_optinteger(L, 2, 1);
+    auto i = v.items.find(o);
+    if (i == v.items.end() || i->second < q)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    if ((i->second -= q) <= 0)
+        v.items.erase(i);
+    v.commands.push_back({ BotCommand::Type::RemoveItem, 0.0f, 0, o, q });
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+int BotScriptExecutor::Worker::GetBuilding(lua_State *L)
+{
+    auto &v = getVisit(L);
+    lua_pushlstring(L, v.building.data(), v.building.size());
+    return 1;
+}
+
+int BotScriptExecutor::Worker::Log(lua_State *L)
+{
+    auto text = luaL_checkstring(L, 1);
+    LOG_DEBUG(logger, "Bot script: " << text);
+    return 0;
+}
+
+BotScriptExecutor::BotScriptExecutor(const path &root, int n_threads, uint64_t instruction_budget)
+    : root(root), instruction_budget(instruction_budget)
+{
+    for (auto &[k, v] : getEngine()->getItems())
+        items.emplace(k.toString(), v);
+
+    for (int i = 0; i < n_threads; i++)
+        workers.push_back(std::make_unique<Worker>(*this));
+    for (auto &p : workers)
+        threads.emplace_back([this, &w = *p]() { run(w); });
+}
+
+BotScriptExecutor::~BotScriptExecutor()
+{
+    {
+        std::lock_guard lk(m);
+        stopped = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void BotScriptExecutor::run(Worker &w)
+{
+    while (1)
+    {
+        std::unique_ptr<BotVisit> v;
+        {
+            std::unique_lock lk(m);
+            cv.wait(lk, [this]() { return stopped || !queue.empty(); });
+            if (stopped)
+                return;
+            v = std::move(queue.front());
+            queue.pop_front();
+        }
+        w.call(*v);
+        std::lock_guard lk(m);
+        done.push_back(std::move(v));
+    }
+}
+
+void BotScriptExecutor::push(detail::Mechanoid *mech, const detail::ModificationMapBuilding *b)
+{
+    if (workers.empty())
+        return;
+    {
+        std::lock_guard lk(m);
+        if (!in_flight.insert(mech).second)
+            return;
+    }
+
+    auto v = std::make_unique<BotVisit>();
+    v->mechanoid = mech;
+    v->script = ScriptEngine::getBuildingScriptName(b);
+    v->building = b->text_id.toString();
+    v->money = mech->getMoney();
+    for (int i = 0; i < rating_types; i++)
+        v->ratings[i] = mech->getRating((detail::RatingType)i);
+    if (auto c = mech->getConfiguration())
+    {
+        if (c->glider)
+            v->items[c->glider.get()] = 1;
+#define ADD_ITEMS(t)                             \
+    for (auto &e : c->t##s)                      \
+    {                                            \
+        if (e->t)                                \
+            v->items[e->t.get()] += e->quantity; \
+    }
+        ADD_ITEMS(equipment);
+        ADD_ITEMS(good);
+        ADD_ITEMS(modificator);
+        ADD_ITEMS(projectile);
+#undef ADD_ITEMS
+        for (auto &w : c->weapons)
+        {
+            if (w->weapon)
+                v->items[w->weapon.get()]++;
+        }
+    }
+
+    {
+        std::lock_guard lk(m);
+        queue.push_back(std::move(v));
+    }
+    cv.notify_one();
+}
+
+void BotScriptExecutor::sync()
+{
+    decltype(done) finished;
+    {
+        std::lock_guard lk(m);
+        finished.swap(done);
+        for (auto &v : finished)
+            in_flight.erase(v->mechanoid);
+    }
+    for (auto &v : finished)
+    {
+        // failed visits change nothing
+        if (!v->error.empty())
+        {
+            LOG_WARN(logger, "Bot script " << v->script << " failed: " << v->error);
+            continue;
+        }
+        apply(*v);
+    }
+}
+
+size_t BotScriptExecutor::getPendingCount() const
+{
+    std::lock_guard lk(m);
+    return in_flight.size();
+}
+
+detail::IObjectBase *BotScriptExecutor::findItem(std::string_view id) const
+{
+    auto i = items.find(id);
+    return i == items.end() ? nullptr : i->second;
+}
+
+void BotScriptExecutor::apply(const BotVisit &v)
+{
+    auto m = v.mechanoid;
+    for (auto &c : v.commands)
+    {
+        switch (c.type)
+        {
+        case BotCommand::Type::AddMoney:
+            m->addMoney(c.value);
+            break;
+        case BotCommand::Type::AddRating:
+        {
+            auto t = (detail::RatingType)c.rating_type;
+            m->setRating(m->getRating(t) + c.value, t);
+            break;
+        }
+        case BotCommand::Type::AddItem:
+            m->getConfiguration()->addItem(c.item, c.quantity);
+            break;
+        case BotCommand::Type::RemoveItem:
+            m->getConfiguration()->removeItem(c.item, c.quantity);
+            break;
+        }
+    }
+}
+
+} // namespace polygon4
@@ -0,0 +1,125 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Polygon4/DataManager/Types.h>
+
+#include "Common.h"
+
+namespace polygon4
+{
+
+// change made by a bot script, applied on the game thread
+struct BotCommand
+{
+    enum class Type
+    {
+        AddMoney,
+        AddRating,
+        AddItem,
+        RemoveItem,
+    };
+
+    Type type;
+    float value = 0.0f;
+    int rating_type = 0;
+    detail::IObjectBase *item = nullptr;
+    int quantity = 0;
+};
+
+// building visit of a bot
+// scripts see a snapshot of the mechanoid and never touch storage
+struct BotVisit
+{
+    detail::Mechanoid *mechanoid = nullptr;
+    std::string script;
+    std::string building;
+
+    float money = 0.0f;
+    // indexed by script RatingType
+    float ratings[4]{};
+    std::unordered_map<const detail::IObjectBase *, int> items;
+
+    std::vector<BotCommand> commands;
+    std::string error;
+};
+
+// runs OnBotEnterBuilding() of building scripts on worker threads
+// every worker owns a lua state with the common script and the Bot api table:
+//     Bot.GetMoney(), Bot.HasMoney(m), Bot.AddMoney(m),
+//     Bot.GetRating(type), Bot.AddRating(r, type),
+//     Bot.HasItem(id, n), Bot.AddItem(id, n), Bot.RemoveItem(id, n),
+//     Bot.GetBuilding(), Bot.Log(text)
+// changes are buffered and applied to storage in sync()
+class BotScriptExecutor
+{
+public:
+    BotScriptExecutor(const path &root, int threads, uint64_t instruction_budget = 0);
+    ~BotScriptExecutor();
+
+    // game thread
+    // takes a snapshot of the mechanoid, one visit per bot is in flight
+    void push(detail::Mechanoid *m, const detail::ModificationMapBuilding *b);
+    // applies finished visits
+    void sync();
+
+    size_t getPendingCount() const;
+
+private:
+    struct Hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    class Worker;
+
+    path root;
+    uint64_t instruction_budget;
+    // read only copy of engine items, engine maps may grow on the game thread
+    std::unordered_map<std::string, detail::IObjectBase *, Hash, std::equal_to<>> items;
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+    bool stopped = false;
+    std::deque<std::unique_ptr<BotVisit>> queue;
+    std::vector<std::unique_ptr<BotVisit>> done;
+    std::unordered_set<const detail::Mechanoid *> in_flight;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    void run(Worker &w);
+    detail::IObjectBase *findItem(std::string_view id) const;
+
+    static void apply(const BotVisit &v);
+};
+
+} // namespace polygon4
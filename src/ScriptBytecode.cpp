@@ -0,0 +1,198 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScriptBytecode.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#include <lua.hpp>
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_bytecode");
+
+namespace fs = std::filesystem;
+
+namespace polygon4
+{
+
+static bool read_file(const fs::path &fn, std::string &s)
+{
+    std::ifstream ifile(fn, std::ios::binary);
+    if (!ifile)
+        return false;
+    s.assign(std::istreambuf_iterator<char>(ifile), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// FNV-1a, stable between runs and builds unlike std::hash
+static uint64_t hash(const std::string &s)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static int writer(lua_State *, const void *p, size_t sz, void *ud)
+{
+    ((std::string *)ud)->append((const char *)p, sz);
+    return 0;
+}
+
+LuaBytecodeCache::LuaBytecodeCache(const fs::path &dir)
+    : dir(dir)
+{
+}
+
+// binary chunks keep the source name they were compiled with,
+// so scripts with the same text must not share an entry
+static std::string get_script_key(const fs::path &fn)
+{
+    std::error_code ec;
+    auto p = fs::weakly_canonical(fn, ec);
+    if (ec)
+        p = fs::absolute(fn, ec).lexically_normal();
+    return p.generic_string();
+}
+
+static std::string get_version_suffix()
+{
+    std::ostringstream ss;
+    ss << "-" << LUA_VERSION_NUM
+#ifdef LUAJIT_VERSION_NUM
+        // luajit bytecode is not compatible with lua 5.1
+        << "-jit" << LUAJIT_VERSION_NUM
+#endif
+        << "-" << sizeof(lua_Number) << "-" << sizeof(void *) << ".luac";
+    return ss.str();
+}
+
+fs::path LuaBytecodeCache::getCacheFilename(const fs::path &fn, const std::string &source) const
+{
+    std::ostringstream ss;
+    ss << std::hex << hash(get_script_key(fn)) << "-" << hash(source) << get_version_suffix();
+    return dir / ss.str();
+}
+
+int LuaBytecodeCache::load(lua_State *L, const fs::path &fn) const
+{
+    auto chunkname = "@" + fn.string();
+
+    std::string source;
+    if (!read_file(fn, source))
+    {
+        lua_pushfstring(L, "cannot open %s", fn.string().c_str());
+        return LUA_ERRFILE;
+    }
+
+    auto cache_fn = getCacheFilename(fn, source);
+    std::string bytecode;
+    if (read_file(cache_fn, bytecode))
+    {
+        if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunkname.c_str(), "b") == LUA_OK)
+            return LUA_OK;
+        // broken or foreign entry, recompile below
+        LOG_DEBUG(logger, "Invalid bytecode cache entry " << cache_fn.string() << ": " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    auto r = luaL_loadbufferx(L, source.data(), source.size(), chunkname.c_str(), "t");
+    if (r != LUA_OK)
+        return r;
+    store(L, cache_fn);
+    return LUA_OK;
+}
+
+bool LuaBytecodeCache::compile(lua_State *L, const fs::path &fn) const
+{
+    std::string source;
+    if (!read_file(fn, source))
+    {
+        LOG_ERROR(logger, "Cannot open " << fn.string());
+        return false;
+    }
+    auto chunkname = "@" + fn.string();
+    if (luaL_loadbufferx(L, source.data(), source.size(), chunkname.c_str(), "t") != LUA_OK)
+    {
+        LOG_ERROR(logger, "Cannot compile " << fn.string() << ": " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    auto r = store(L, getCacheFilename(fn, source));
+    lua_pop(L, 1);
+    return r;
+}
+
+bool LuaBytecodeCache::store(lua_State *L, const fs::path &cache_fn) const
+{
+    // function is on the top of the stack
+    std::string bytecode;
+#if LUA_VERSION_NUM >= 503
+    if (lua_dump(L, writer, &bytecode, 0) != 0)
+#else
+    if (lua_dump(L, writer, &bytecode) != 0)
+#endif
+        return false;
+
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    // write to a temporary file first, so readers never see partial entries
+    std::ostringstream ss;
+    ss << "." << std::this_thread::get_id() << ".tmp";
+    auto tmp = cache_fn;
+    tmp += ss.str();
+    {
+        std::ofstream ofile(tmp, std::ios::binary);
+        if (!ofile)
+        {
+            LOG_WARN(logger, "Cannot write bytecode cache entry: " << tmp.string());
+            return false;
+        }
+        ofile.write(bytecode.data(), bytecode.size());
+    }
+    fs::rename(tmp, cache_fn, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        return false;
+    }
+
+    // drop entries of previous versions of the script
+    auto name = cache_fn.filename().string();
+    auto prefix = name.substr(0, name.find('-') + 1);
+    auto suffix = get_version_suffix();
+    for (auto i = fs::directory_iterator(dir, ec); !ec && i != fs::directory_iterator(); i.increment(ec))
+    {
+        auto f = i->path().filename().string();
+        if (f != name && f.starts_with(prefix) && f.ends_with(suffix))
+        {
+            std::error_code ec2;
+            fs::remove(i->path(), ec2);
+        }
+    }
+    return true;
+}
+
+} // namespace polygon4
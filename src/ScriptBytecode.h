@@ -0,0 +1,54 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+struct lua_State;
+
+namespace polygon4
+{
+
+// on-disk cache of compiled lua chunks
+// entries are keyed by script path, source hash and lua version,
+// so a changed source or a different vm never picks up stale bytecode
+// storing a new entry removes the older ones of the same script
+class LuaBytecodeCache
+{
+public:
+    LuaBytecodeCache(const std::filesystem::path &dir);
+
+    // same contract as luaL_loadfile():
+    // pushes the chunk or an error message and returns lua status
+    int load(lua_State *L, const std::filesystem::path &fn) const;
+
+    // compiles source and stores it in the cache
+    bool compile(lua_State *L, const std::filesystem::path &fn) const;
+
+    const std::filesystem::path &getDirectory() const { return dir; }
+
+private:
+    std::filesystem::path dir;
+
+    std::filesystem::path getCacheFilename(const std::filesystem::path &fn, const std::string &source) const;
+    bool store(lua_State *L, const std::filesystem::path &cache_fn) const;
+};
+
+} // namespace polygon4
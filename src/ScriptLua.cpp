@@ -18,7 +18,22 @@
 
 #include "ScriptLua.h"
 
-#include <lua.hpp>
+#include "ScriptBytecode.h"
+#include "ScriptLuaBindings.h"
+#include "ScriptProfiler.h"
+#include "ScriptScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+
+#include "ScriptLuaCompat.h"
+
+#include <Polygon4/Engine.h>
+#include <Polygon4/Modification.h>
 
 #include <ScriptAPI_lua.cpp>
 
@@ -28,58 +43,531 @@ DECLARE_STATIC_LOGGER(logger, "script_lua");
 namespace polygon4
 {
 
-ScriptLua::ScriptLua()
-{
-    L = luaL_newstate();
-    luaopen_base(L);
+// registry key of the context pointer
+static const char hook_key = 0;
+
+static int panic(lua_State *L)
+{
+    LOG_FATAL(logger, "Unprotected error in lua: " << lua_tostring(L, -1));
+    return 0;
+}
+
+ScriptLuaContext::ScriptLuaContext(const LuaBytecodeCache *cache, size_t memory_limit, bool jit)
+    : allocator(memory_limit), cache(cache)
+{
+    L = lua_newstate(LuaAllocator::alloc, &allocator);
+#ifdef LUAJIT_VERSION
+    // 64-bit luajit without gc64 works only with its own allocator
+    if (!L)
+    {
+        LOG_WARN(logger, "Custom allocator is not supported by " LUAJIT_VERSION ", script memory limit is disabled");
+        L = luaL_newstate();
+    }
+#endif
+    if (!L)
+        throw std::runtime_error("Cannot create lua state");
+    lua_atpanic(L, panic);
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &hook_key);
+    luaopen_base(L);
+#ifdef LUAJIT_VERSION
+    // also turns the compiler on
+    lua_pushcfunction(L, luaopen_jit);
+    lua_call(L, 0, 0);
+    if (!jit)
+        luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+#endif
     luaopen_Polygon4(L);
+
+    scheduler = std::make_unique<LuaScheduler>(*this);
+    scheduler->open();
+    bindings = std::make_unique<LuaFastBindings>(*this);
+    bindings->open(L);
 }
 
-ScriptLua::~ScriptLua()
-{
+ScriptLuaContext::~ScriptLuaContext()
+{
     lua_close(L);
 }
 
+ScriptLuaContext *ScriptLuaContext::get(lua_State *L)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &hook_key);
+    auto c = (ScriptLuaContext *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return c;
+}
+
+void ScriptLuaContext::hook(lua_State *L, lua_Debug *ar)
+{
+    auto c = get(L);
+    if (!c)
+        return;
+    auto p = c->profiler.get();
+    switch (ar->event)
+    {
+    case LUA_HOOKCALL:
+        if (p)
+            p->onCall(L, ar);
+        break;
+#if LUA_VERSION_NUM >= 502
+    case LUA_HOOKTAILCALL:
+        if (p)
+            p->onCall(L, ar, true);
+        break;
+#else
+    // lua 5.1 reports frames replaced by tail calls when they return
+    case LUA_HOOKTAILRET:
+#endif
+    case LUA_HOOKRET:
+        if (p)
+            p->onReturn(L, ar);
+        break;
+    case LUA_HOOKCOUNT:
+        c->instructions += c->hook_count;
+        if (p && (c->profile_count += c->hook_count) >= p->getSampleInterval())
+        {
+            c->profile_count = 0;
+            p->onCount(L, ar);
+        }
+        if (c->call_depth)
+            c->checkBudget(L);
+        break;
+    }
+}
+
+void ScriptLuaContext::updateHook()
+{
+    // budget is checked at least this often
+    const int budget_check_interval = 1000;
+
+    int mask = 0;
+    int count = 0;
+    if (profiler)
+    {
+        mask |= LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT;
+        count = profiler->getSampleInterval();
+    }
+    if (instruction_budget || time_budget.count())
+    {
+        mask |= LUA_MASKCOUNT;
+        auto n = budget_check_interval;
+        if (instruction_budget && instruction_budget < (uint64_t)n)
+            n = (int)instruction_budget;
+        count = count ? std::min(count, n) : n;
+    }
+    hook_count = count;
+    profile_count = 0;
+    lua_sethook(L, mask ? hook : nullptr, mask, count);
+}
+
+void ScriptLuaContext::setBudget(uint64_t instructions, int time_ms)
+{
+    auto t = std::chrono::milliseconds(time_ms > 0 ? time_ms : 0);
+    if (instruction_budget == instructions && time_budget == t)
+        return;
+    instruction_budget = instructions;
+    time_budget = t;
+    updateHook();
+}
+
+void ScriptLuaContext::beginCall()
+{
+    if (call_depth++)
+        return;
+    instructions = 0;
+    over_budget = false;
+    call_start = std::chrono::steady_clock::now();
+}
+
+void ScriptLuaContext::endCall()
+{
+    if (--call_depth)
+        return;
+    auto t = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - call_start).count();
+    call_stats.calls++;
+    call_stats.max_time_ms = std::max(call_stats.max_time_ms, t);
+    if (over_budget)
+        call_stats.aborted++;
+}
+
+void ScriptLuaContext::checkBudget(lua_State *L)
+{
+    if (instruction_budget && instructions > instruction_budget)
+    {
+        over_budget = true;
+        // luaL_error() may longjmp, so no std::string here
+        char budget[32];
+        snprintf(budget, sizeof(budget), "%llu", (unsigned long long)instruction_budget);
+        luaL_error(L, "script call is over the instruction budget (%s)", budget);
+    }
+    if (time_budget.count() && std::chrono::steady_clock::now() - call_start > time_budget)
+    {
+        over_budget = true;
+        luaL_error(L, "script call is over the time budget (%d ms)", (int)time_budget.count());
+    }
+}
+
+ScriptCallStats ScriptLuaContext::getCallStats() const
+{
+    auto s = call_stats;
+    s.waiting = scheduler->getWaitingCount();
+    return s;
+}
+
+void ScriptLuaContext::update(int64_t playtime)
+{
+    scheduler->update(playtime);
+}
+
+void ScriptLuaContext::onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building)
+{
+    scheduler->onBuildingVisit(player, building);
+}
+
+void ScriptLuaContext::onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item)
+{
+    scheduler->onItemAdded(player, item);
+}
+
+// times the same calls through swig wrappers and through the P4 table
+static const char *bench_chunk = R"(
+local data, clock, n = ...
+local function run(f)
+    local s = clock()
+    f()
+    return clock() - s
+end
+local t = {}
+t[1] = run(function() for i = 1, n do data:SetVar("__bench", i) end end)
+t[2] = run(function() for i = 1, n do P4.SetVar("__bench", i) end end)
+t[3] = run(function() for i = 1, n do data:GetVar("__bench") end end)
+t[4] = run(function() for i = 1, n do P4.GetVar("__bench") end end)
+t[5] = run(function() for i = 1, n do data:CheckVar("__bench") end end)
+t[6] = run(function() for i = 1, n do P4.CheckVar("__bench") end end)
+data:UnsetVar("__bench")
+return t[1], t[2], t[3], t[4], t[5], t[6]
+)";
+
+static int bench_clock(lua_State *L)
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    lua_pushnumber(L, std::chrono::duration<double>(t).count());
+    return 1;
+}
+
+std::string ScriptLuaContext::benchmarkBindings(ScriptData &data, int iterations)
+{
+    static const char *names[] = { "SetVar", "GetVar", "CheckVar" };
+
+    if (iterations <= 0)
+        return {};
+
+    auto top = lua_gettop(L);
+    if (luaL_loadstring(L, bench_chunk) != LUA_OK)
+    {
+        std::string e = lua_tostring(L, -1);
+        lua_settop(L, top);
+        return "Cannot load benchmark: " + e;
+    }
+    SWIG_NewPointerObj(L, &data, SWIGTYPE_p_polygon4__script__ScriptData, 0);
+    lua_pushcfunction(L, bench_clock);
+    lua_pushinteger(L, iterations);
+
+    auto prev = current_data;
+    current_data = &data;
+    auto r = lua_pcall(L, 3, 6, 0);
+    current_data = prev;
+
+    std::ostringstream ss;
+    if (r != LUA_OK)
+        ss << "Benchmark failed: " << lua_tostring(L, -1);
+    else
+    {
+        ss << std::fixed << std::setprecision(1);
+        ss << "Script bindings, " << iterations << " calls, ns/call (swig / fast):";
+        for (int i = 0; i < 3; i++)
+        {
+            auto swig = lua_tonumber(L, top + 1 + i * 2) * 1e9 / iterations;
+            auto fast = lua_tonumber(L, top + 2 + i * 2) * 1e9 / iterations;
+            ss << "\n    " << names[i] << ": " << swig << " / " << fast;
+            if (fast > 0)
+                ss << " (x" << swig / fast << ")";
+        }
+    }
+    lua_settop(L, top);
+    return ss.str();
+}
+
+void ScriptLuaContext::startProfiling(int sample_interval)
+{
+    profiler = std::make_unique<LuaProfiler>(sample_interval);
+    updateHook();
+}
+
+void ScriptLuaContext::stopProfiling(const path &dir)
+{
+    if (!profiler)
+        return;
+    if (!profiler->empty())
+        profiler->save(dir);
+    profiler.reset();
+    updateHook();
+}
+
+std::unique_ptr<Script> ScriptLuaContext::createCommonScript()
+{
+    return std::make_unique<ScriptLua>(*this, true);
+}
+
+std::unique_ptr<Script> ScriptLuaContext::createScript()
+{
+    return std::make_unique<ScriptLua>(*this);
+}
+
+ScriptLua::ScriptLua(ScriptLuaContext &context, bool common)
+    : context(context), L(context.getState())
+{
+    auto used = context.getAllocator().getUsed();
+    if (common)
+    {
+        // common script works directly with globals
+        lua_pushglobaltable(L);
+    }
+    else
+    {
+        // setmetatable({}, { __index = _G })
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_pushglobaltable(L);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, -2);
+    }
+    env = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    for (auto &ep : entryPoints)
+        ep = LUA_NOREF;
+
+    account(used);
+}
+
+ScriptLua::~ScriptLua()
+{
+    context.getScheduler().cancel(this);
+    for (auto ep : entryPoints)
+        luaL_unref(L, LUA_REGISTRYINDEX, ep);
+    luaL_unref(L, LUA_REGISTRYINDEX, env);
+}
+
+void ScriptLua::resolveEntryPoints()
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+    for (int i = 0; i < (int)ScriptEntryPoint::Max; i++)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, entryPoints[i]);
+        entryPoints[i] = LUA_NOREF;
+
+        lua_getfield(L, -1, getEntryPointName((ScriptEntryPoint)i));
+        if (lua_isfunction(L, -1))
+            entryPoints[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+        else
+            lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+void ScriptLua::account(size_t used_before)
+{
+    memory += (int64_t)context.getAllocator().getUsed() - (int64_t)used_before;
+}
+
 bool ScriptLua::loadScriptFile(const path &p)
-{
-    // load file
-    if (luaL_loadfile(L, p.string().c_str()))
-    {
-        LOG_ERROR(logger, "Error during load file: " << lua_tostring(L, -1));
-        return false;
-    }
-    // execute global statements
-    if (lua_pcall(L, 0, 0, 0))
-    {
-        LOG_ERROR(logger, "Error during load file: " << lua_tostring(L, -1));
-        return false;
+{
+    auto used = context.getAllocator().getUsed();
+    // load file
+    auto cache = context.getBytecodeCache();
+    auto r = cache ? cache->load(L, p) : luaL_loadfile(L, p.string().c_str());
+    if (r)
+    {
+        LOG_ERROR(logger, "Error during load file: " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+    set_chunk_env(L);
+    // execute global statements
+    auto profiler = context.getProfiler();
+    auto depth = profiler ? profiler->getDepth() : 0;
+    context.beginCall();
+    r = lua_pcall(L, 0, 0, 0);
+    context.endCall();
+    if (r)
+    {
+        LOG_ERROR(logger, "Error during load file: " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+        if (profiler)
+            profiler->unwind(depth);
+        account(used);
+        return false;
     }
+    resolveEntryPoints();
+    account(used);
     return true;
 }
 
-void ScriptLua::call(const FunctionName &fn, const ScriptParameters &params)
+void ScriptLua::pushData()
+{
+    SWIG_NewPointerObj(L, &data, SWIGTYPE_p_polygon4__script__ScriptData, 0);
+}
+
+void ScriptLua::pcall(int nargs, std::string_view fn, bool can_wait)
+{
+    auto used = context.getAllocator().getUsed();
+    auto trace = context.getTrace();
+    if (trace)
+        traceCall(*trace, nargs, fn);
+    auto start = std::chrono::steady_clock::now();
+    // function, script data and nargs arguments are on the stack
+    // entry points run as coroutines, so they can wait for events
+    auto ok = context.getScheduler().start(this, nargs + 1, fn, can_wait);
+    if (trace)
+        trace->endCall(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), ok);
+    account(used);
+}
+
+static int64_t get_player_index(const detail::ModificationPlayer *player)
+{
+    auto m = getEngine()->getCurrentModification();
+    if (!player || !m)
+        return -1;
+    auto i = std::find(m->players.begin(), m->players.end(), player);
+    return i == m->players.end() ? -1 : i - m->players.begin();
+}
+
+void ScriptLua::traceCall(ScriptTraceWriter &trace, int nargs, std::string_view fn)
+{
+    TraceCall c;
+    c.script = getName();
+    c.function = fn;
+    c.player = get_player_index(data.player);
+    if (data.building)
+        c.building = data.building->text_id.toString();
+    c.playtime = (int64_t)GET_SETTINGS().playtime;
+
+    // arguments follow the function and script data
+    auto top = lua_gettop(L);
+    for (int i = top - nargs + 1; i <= top; i++)
+    {
+        switch (lua_type(L, i))
+        {
+        case LUA_TBOOLEAN:
+            c.args.emplace_back(lua_toboolean(L, i) != 0);
+            break;
+        case LUA_TNUMBER:
+            c.args.emplace_back((double)lua_tonumber(L, i));
+            break;
+        case LUA_TSTRING:
+        {
+            size_t n;
+            auto s = lua_tolstring(L, i, &n);
+            c.args.emplace_back(std::string(s, n));
+            break;
+        }
+        default:
+            // tables and functions are not passed by the engine
+            c.args.emplace_back();
+            break;
+        }
+    }
+    trace.beginCall(c);
+}
+
+static void push(lua_State *L, const ScriptArgument &a)
+{
+    std::visit([L](auto &&v)
+    {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::string_view>)
+            lua_pushlstring(L, v.data(), v.size());
+        else if constexpr (std::is_same_v<T, bool>)
+            lua_pushboolean(L, v);
+        else if constexpr (std::is_same_v<T, int64_t>)
+            lua_pushinteger(L, (lua_Integer)v);
+        else
+            lua_pushnumber(L, (lua_Number)v);
+    }, a);
+}
+
+void ScriptLua::call(const FunctionName &fn, const ScriptParameters &params)
 {
     LOG_TRACE(logger, "call(fn = " << fn.toString() << ")");
 
-    // find function
-    lua_getglobal(L, fn.toString().c_str());
+    // find function, missing names fall back to globals
+    auto name = fn.toString();
+    lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+    lua_getfield(L, -1, name.c_str());
+    lua_remove(L, -2);
 
-    // push script data
-    SWIG_NewPointerObj(L, &data, SWIGTYPE_p_polygon4__script__ScriptData, 0);
+    pushData();
 
     // push other args (string only for now)
-    std::vector<std::string> params_store;
-    params_store.reserve(params.size());
     for (auto &p : params)
     {
-        params_store.emplace_back(p.toString());
-        lua_pushstring(L, params_store.back().c_str());
+        auto s = p.toString();
+        lua_pushlstring(L, s.data(), s.size());
     }
 
-    if (lua_pcall(L, params.size() + 1, 0, 0))
-    {
-        LOG_ERROR(logger, "Error during call to '" << fn.toString() << "': " << lua_tostring(L, -1));
+    pcall((int)params.size(), name);
+}
+
+void ScriptLua::call(ScriptEntryPoint ep, ScriptArguments args)
+{
+    auto ref = entryPoints[(int)ep];
+    LOG_TRACE(logger, "call(fn = " << getEntryPointName(ep) << ")");
+
+    if (ref == LUA_NOREF)
+    {
+        LOG_DEBUG(logger, "No entry point '" << getEntryPointName(ep) << "'");
+        return;
     }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    pushData();
+    for (auto &a : args)
+        push(L, a);
+    // waits are not saved, quests must be registered within the visit
+    pcall((int)args.size(), getEntryPointName(ep), ep != ScriptEntryPoint::RegisterQuests);
+}
+
+void ScriptLua::pushFunction(std::string_view fn)
+{
+    // env[fn] without creating std::string
+    lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+    lua_pushlstring(L, fn.data(), fn.size());
+    lua_gettable(L, -2);
+    lua_remove(L, -2);
+}
+
+void ScriptLua::invoke(std::string_view fn, ScriptArguments args)
+{
+    LOG_TRACE(logger, "invoke(fn = " << fn << ")");
+
+    pushFunction(fn);
+    pushData();
+    for (auto &a : args)
+        push(L, a);
+    pcall((int)args.size(), fn);
+}
+
+void ScriptLua::invoke(std::string_view fn, const std::vector<ScriptArgument> &args)
+{
+    LOG_TRACE(logger, "invoke(fn = " << fn << ", n = " << args.size() << ")");
+
+    pushFunction(fn);
+    pushData();
+    for (auto &a : args)
+        push(L, a);
+    pcall((int)args.size(), fn);
 }
 
 } // namespace polygon4
@@ -20,27 +20,120 @@
 
 #include "Script.h"
 
+#include <chrono>
+
+struct lua_Debug;
 struct lua_State;
 
 namespace polygon4
 {
 
+class LuaBytecodeCache;
+class LuaFastBindings;
+class LuaProfiler;
+class LuaScheduler;
+
+// one lua vm per script engine
+// common script is loaded into globals, other scripts get their own
+// environment tables that fall back to globals
+class ScriptLuaContext : public ScriptContext
+{
+public:
+    ScriptLuaContext(const LuaBytecodeCache *cache = nullptr, size_t memory_limit = 0, bool jit = true);
+    virtual ~ScriptLuaContext();
+
+    virtual std::unique_ptr<Script> createCommonScript() override;
+    virtual std::unique_ptr<Script> createScript() override;
+    virtual ScriptMemoryStats getMemoryStats() const override { return allocator.getStats(); }
+    virtual void startProfiling(int sample_interval) override;
+    virtual void stopProfiling(const path &dir) override;
+    virtual ScriptCallStats getCallStats() const override;
+    virtual void setBudget(uint64_t instructions, int time_ms) override;
+    virtual void update(int64_t playtime) override;
+    virtual void onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building) override;
+    virtual void onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item) override;
+    virtual std::string benchmarkBindings(ScriptData &data, int iterations) override;
+
+    // wrap every lua_pcall from the engine
+    // nested calls share the budget of the outermost one
+    void beginCall();
+    void endCall();
+    void countError() { call_stats.errors++; }
+
+    lua_State *getState() const { return L; }
+    const LuaBytecodeCache *getBytecodeCache() const { return cache; }
+    const LuaAllocator &getAllocator() const { return allocator; }
+    LuaProfiler *getProfiler() const { return profiler.get(); }
+    LuaScheduler &getScheduler() const { return *scheduler; }
+
+    // data of the running entry point, used by functions without a data argument
+    ScriptData *getCurrentData() const { return current_data; }
+    void setCurrentData(ScriptData *d) { current_data = d; }
+
+    static ScriptLuaContext *get(lua_State *L);
+
+private:
+    // must outlive the state
+    LuaAllocator allocator;
+    lua_State *L;
+    const LuaBytecodeCache *cache;
+    std::unique_ptr<LuaProfiler> profiler;
+    int profile_count = 0;
+    std::unique_ptr<LuaScheduler> scheduler;
+    std::unique_ptr<LuaFastBindings> bindings;
+    ScriptData *current_data = nullptr;
+
+    // budget of the current call
+    uint64_t instruction_budget = 0;
+    std::chrono::milliseconds time_budget{};
+    int call_depth = 0;
+    uint64_t instructions = 0;
+    std::chrono::steady_clock::time_point call_start;
+    bool over_budget = false;
+    ScriptCallStats call_stats;
+
+    // lua has one hook per state, it dispatches events to the users above
+    int hook_count = 0;
+    static void hook(lua_State *L, lua_Debug *ar);
+    void updateHook();
+    void checkBudget(lua_State *L);
+};
+
 class ScriptLua : public Script
 {
 public:
-    ScriptLua();
+    ScriptLua(ScriptLuaContext &context, bool common = false);
     virtual ~ScriptLua();
 
     virtual std::string getScriptExtension() const override { return "lua"; }
+    virtual size_t getMemoryUsage() const override { return memory > 0 ? (size_t)memory : 0; }
 
 private:
     virtual bool loadScriptFile(const path &p) override;
 
 public: /* API */
     virtual void call(const FunctionName &fn, const ScriptParameters &params = ScriptParameters()) override;
+    virtual void call(ScriptEntryPoint ep, ScriptArguments args = {}) override;
+    virtual void invoke(std::string_view fn, ScriptArguments args = {}) override;
+    virtual void invoke(std::string_view fn, const std::vector<ScriptArgument> &args) override;
 
 private:
+    ScriptLuaContext &context;
     lua_State *L;
+    // registry reference to the environment table
+    int env;
+    // registry references to entry point functions
+    int entryPoints[(int)ScriptEntryPoint::Max];
+    // net vm allocations made by this script
+    // approximate: gc may free other scripts' objects meanwhile
+    int64_t memory = 0;
+
+    void resolveEntryPoints();
+    void pushFunction(std::string_view fn);
+    void pushData();
+    void pcall(int nargs, std::string_view fn, bool can_wait = true);
+    void account(size_t used_before);
+    void traceCall(ScriptTraceWriter &trace, int nargs, std::string_view fn);
 };
 
 } // namespace polygon4
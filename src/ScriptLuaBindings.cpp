@@ -0,0 +1,360 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptLuaBindings.h"
+
+#include <Polygon4/BuildingMenu.h>
+#include <Polygon4/Engine.h>
+#include <Polygon4/Mechanoid.h>
+#include <Polygon4/Modification.h>
+
+#include "ScriptLua.h"
+
+#include "ScriptLuaCompat.h"
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_lua");
+
+namespace polygon4
+{
+
+static std::string_view check_string(lua_State *L, int i)
+{
+    size_t n;
+    auto s = luaL_checklstring(L, i, &n);
+    return { s, n };
+}
+
+// null when no game is running
+static ScriptEngine *get_script_engine()
+{
+    auto m = getEngine()->getCurrentModification();
+    return m ? m->getScriptEngine() : nullptr;
+}
+
+static ScriptVariables *get_variables()
+{
+    auto se = get_script_engine();
+    return se ? &se->getVariables() : nullptr;
+}
+
+// for lua functions, raises a lua error without a running game
+static ScriptVariables &check_variables(lua_State *L)
+{
+    auto vars = get_variables();
+    if (!vars)
+        luaL_error(L, "P4 functions can be used only in a running game");
+    return *vars;
+}
+
+// queries are traced under the names of ScriptData functions, so traces
+// do not depend on the binding path
+static int trace_query(const char *name, std::string_view arg, int result)
+{
+    if (auto se = get_script_engine())
+        se->traceQuery(name, arg, result);
+    return result;
+}
+
+#ifdef LUAJIT_VERSION
+
+// ffi functions must not raise lua errors, they return -1 instead
+
+static int ffi_get_var(void *b, const char *name, size_t len, int *value)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto vars = get_variables();
+    if (!vars)
+        return -1;
+    auto v = vars->find(d->player, { name, len });
+    *value = trace_query("GetVar", { name, len }, v ? v->value_int : 0);
+    return 0;
+}
+
+static int ffi_check_var(void *b, const char *name, size_t len)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto vars = get_variables();
+    if (!vars)
+        return -1;
+    return trace_query("CheckVar", { name, len }, vars->find(d->player, { name, len }) != nullptr);
+}
+
+static int ffi_set_var_int(void *b, const char *name, size_t len, int value)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto vars = get_variables();
+    if (!vars)
+        return -1;
+    vars->get(d->player, { name, len })->value_int = value;
+    return 0;
+}
+
+static int ffi_set_var_text(void *b, const char *name, size_t len, const char *value, size_t value_len)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto vars = get_variables();
+    if (!vars)
+        return -1;
+    vars->get(d->player, { name, len })->value_text = std::string(value, value_len);
+    return 0;
+}
+
+static int ffi_run_once(void *b, const char *name, size_t len)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto vars = get_variables();
+    if (!vars)
+        return -1;
+    if (trace_query("CheckVar", { name, len }, vars->find(d->player, { name, len }) != nullptr))
+        return 0;
+    vars->get(d->player, { name, len })->value_int = 1;
+    return 1;
+}
+
+static int ffi_has_item(void *b, const char *name, size_t len, int quantity)
+{
+    auto d = ((LuaFastBindings *)b)->getData();
+    if (!d)
+        return -1;
+    auto o = ((LuaFastBindings *)b)->findItem({ name, len });
+    if (!o)
+        return trace_query("HasItem", { name, len }, 0);
+    return trace_query("HasItem", { name, len }, d->player->mechanoid->getConfiguration()->hasItem(o, quantity));
+}
+
+static void ffi_add_text(void *b, const char *text, size_t len)
+{
+    GET_BUILDING_MENU()->getTextBuffer().appendUtf8({ text, len });
+}
+
+// functions are passed as pointers, so nothing has to be exported from the binary
+static const char *ffi_chunk = R"(
+local ffi, ctx, fn = ...
+local get_var = ffi.cast("int (*)(void *, const char *, size_t, int *)", fn.get_var)
+local check_var = ffi.cast("int (*)(void *, const char *, size_t)", fn.check_var)
+local set_var_int = ffi.cast("int (*)(void *, const char *, size_t, int)", fn.set_var_int)
+local set_var_text = ffi.cast("int (*)(void *, const char *, size_t, const char *, size_t)", fn.set_var_text)
+local run_once = ffi.cast("int (*)(void *, const char *, size_t)", fn.run_once)
+local has_item = ffi.cast("int (*)(void *, const char *, size_t, int)", fn.has_item)
+local add_text = ffi.cast("void (*)(void *, const char *, size_t)", fn.add_text)
+local value = ffi.new("int[1]")
+
+local function check(r)
+    if r < 0 then
+        error("P4 functions can be used only in script entry points", 3)
+    end
+    return r
+end
+
+P4.GetVar = function(name)
+    check(get_var(ctx, name, #name, value))
+    return value[0]
+end
+P4.CheckVar = function(name)
+    return check(check_var(ctx, name, #name)) == 1
+end
+P4.SetVar = function(name, v)
+    if type(v) == "string" then
+        check(set_var_text(ctx, name, #name, v, #v))
+    else
+        check(set_var_int(ctx, name, #name, v or 1))
+    end
+end
+P4.RunOnce = function(name)
+    return check(run_once(ctx, name, #name)) == 1
+end
+P4.HasItem = function(name, quantity)
+    return check(has_item(ctx, name, #name, quantity or 1)) == 1
+end
+P4.AddText = function(text)
+    add_text(ctx, text, #text)
+end
+)";
+
+static void open_ffi(lua_State *L, LuaFastBindings *b)
+{
+    static const std::pair<const char *, void *> functions[] =
+    {
+        { "get_var", (void *)ffi_get_var },
+        { "check_var", (void *)ffi_check_var },
+        { "set_var_int", (void *)ffi_set_var_int },
+        { "set_var_text", (void *)ffi_set_var_text },
+        { "run_once", (void *)ffi_run_once },
+        { "has_item", (void *)ffi_has_item },
+        { "add_text", (void *)ffi_add_text },
+    };
+
+    if (luaL_loadstring(L, ffi_chunk) != LUA_OK)
+    {
+        LOG_ERROR(logger, "Cannot load ffi bindings: " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    // ffi module is given to the bindings only, scripts do not see it
+    lua_pushcfunction(L, luaopen_ffi);
+    lua_call(L, 0, 1);
+    lua_pushlightuserdata(L, b);
+    lua_newtable(L);
+    for (auto &[n, f] : functions)
+    {
+        lua_pushlightuserdata(L, f);
+        lua_setfield(L, -2, n);
+    }
+    // on failure the C closures stay in place
+    if (lua_pcall(L, 3, 0, 0) != LUA_OK)
+    {
+        LOG_ERROR(logger, "Cannot load ffi bindings: " << lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+#endif
+
+LuaFastBindings::LuaFastBindings(ScriptLuaContext &context)
+    : context(context)
+{
+}
+
+void LuaFastBindings::open(lua_State *L)
+{
+    static const luaL_Reg functions[] =
+    {
+        { "GetVar", GetVar },
+        { "CheckVar", CheckVar },
+        { "SetVar", SetVar },
+        { "RunOnce", RunOnce },
+        { "HasItem", HasItem },
+        { "AddText", AddText },
+        { nullptr, nullptr },
+    };
+
+    lua_newtable(L);
+    lua_pushlightuserdata(L, this);
+    luaL_setfuncs(L, functions, 1);
+    lua_setglobal(L, "P4");
+#ifdef LUAJIT_VERSION
+    open_ffi(L, this);
+#endif
+}
+
+LuaFastBindings &LuaFastBindings::get(lua_State *L)
+{
+    return *(LuaFastBindings *)lua_touserdata(L, lua_upvalueindex(1));
+}
+
+ScriptData *LuaFastBindings::getData() const
+{
+    auto d = context.getCurrentData();
+    return d && d->player ? d : nullptr;
+}
+
+ScriptData &LuaFastBindings::getData(lua_State *L)
+{
+    auto d = get(L).getData();
+    if (!d)
+        luaL_error(L, "P4 functions can be used only in script entry points");
+    return *d;
+}
+
+detail::IObjectBase *LuaFastBindings::findItem(std::string_view name)
+{
+    auto se = get_script_engine();
+    return se ? se->getReferences().find(ScriptReferences::Type::Item, name) : nullptr;
+}
+
+int LuaFastBindings::GetVar(lua_State *L)
+{
+    auto &d = getData(L);
+    auto key = check_string(L, 1);
+    auto v = check_variables(L).find(d.player, key);
+    lua_pushinteger(L, trace_query("GetVar", key, v ? v->value_int : 0));
+    return 1;
+}
+
+int LuaFastBindings::CheckVar(lua_State *L)
+{
+    auto &d = getData(L);
+    auto key = check_string(L, 1);
+    lua_pushboolean(L, trace_query("CheckVar", key, check_variables(L).find(d.player, key) != nullptr));
+    return 1;
+}
+
+int LuaFastBindings::SetVar(lua_State *L)
+{
+    auto &d = getData(L);
+    auto key = check_string(L, 1);
+    if (lua_type(L, 2) == LUA_TSTRING)
+    {
+        auto val = check_string(L, 2);
+        check_variables(L).get(d.player, key)->value_text = std::string(val);
+    }
+    else
+    {
+        auto val = (int)luaL_optinteger(L, 2, 1);
+        check_variables(L).get(d.player, key)->value_int = val;
+    }
+    return 0;
+}
+
+int LuaFastBindings::RunOnce(lua_State *L)
+{
+    auto &d = getData(L);
+    auto key = check_string(L, 1);
+    auto &vars = check_variables(L);
+    auto first = !trace_query("CheckVar", key, vars.find(d.player, key) != nullptr);
+    if (first)
+        vars.get(d.player, key)->value_int = 1;
+    lua_pushboolean(L, first);
+    return 1;
+}
+
+int LuaFastBindings::HasItem(lua_State *L)
+{
+    auto &d = getData(L);
+    auto name = check_string(L, 1);
+    auto quantity = (int)luaL_optinteger(L, 2, 1);
+    auto o = get(L).findItem(name);
+    if (!o)
+    {
+        lua_pushboolean(L, trace_query("HasItem", name, 0));
+        return 1;
+    }
+    lua_pushboolean(L, trace_query("HasItem", name, d.player->mechanoid->getConfiguration()->hasItem(o, quantity)));
+    return 1;
+}
+
+int LuaFastBindings::AddText(lua_State *L)
+{
+    auto text = check_string(L, 1);
+    GET_BUILDING_MENU()->getTextBuffer().appendUtf8(text);
+    return 0;
+}
+
+} // namespace polygon4
@@ -0,0 +1,65 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string_view>
+
+#include "Script.h"
+
+struct lua_State;
+
+namespace polygon4
+{
+
+class ScriptLuaContext;
+
+// hand written bindings for the hottest script api calls, the rest stays with swig
+// functions live in the global P4 table and work on the data of the running call:
+//     P4.GetVar(name), P4.CheckVar(name), P4.SetVar(name, value), P4.RunOnce(name),
+//     P4.HasItem(name, quantity), P4.AddText(text)
+// they skip swig userdata checks and look names up without building std::string
+// with luajit the table is filled with ffi wrappers instead, the compiler can inline
+// ffi calls into traces while lua_CFunction calls stop them
+class LuaFastBindings
+{
+public:
+    LuaFastBindings(ScriptLuaContext &context);
+
+    void open(lua_State *L);
+
+    // null outside of entry points
+    ScriptData *getData() const;
+    detail::IObjectBase *findItem(std::string_view name);
+
+private:
+    ScriptLuaContext &context;
+
+    static LuaFastBindings &get(lua_State *L);
+    static ScriptData &getData(lua_State *L);
+
+    static int GetVar(lua_State *L);
+    static int CheckVar(lua_State *L);
+    static int SetVar(lua_State *L);
+    static int RunOnce(lua_State *L);
+    static int HasItem(lua_State *L);
+    static int AddText(lua_State *L);
+};
+
+} // namespace polygon4
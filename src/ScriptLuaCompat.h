@@ -0,0 +1,72 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lua.hpp>
+
+// the engine is written against lua 5.2+ api
+// luajit provides lua 5.1 api, missing parts are emulated here
+
+#if LUA_VERSION_NUM < 502
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+// swig runtime defines it as a macro
+#ifndef lua_pushglobaltable
+inline void lua_pushglobaltable(lua_State *L)
+{
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+}
+#endif
+
+// idx must be a pseudo index like LUA_REGISTRYINDEX
+inline void lua_rawsetp(lua_State *L, int idx, const void *p)
+{
+    lua_pushlightuserdata(L, (void *)p);
+    lua_insert(L, -2);
+    lua_rawset(L, idx);
+}
+
+inline void lua_rawgetp(lua_State *L, int idx, const void *p)
+{
+    lua_pushlightuserdata(L, (void *)p);
+    lua_rawget(L, idx);
+}
+
+#endif
+
+namespace polygon4
+{
+
+// sets the table on the top of the stack as environment of the function below it
+inline void set_chunk_env(lua_State *L)
+{
+#if LUA_VERSION_NUM >= 502
+    // main chunk's first upvalue is _ENV
+    if (!lua_setupvalue(L, -2, 1))
+        lua_pop(L, 1);
+#else
+    lua_setfenv(L, -2);
+#endif
+}
+
+} // namespace polygon4
@@ -0,0 +1,190 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+
+#include <lua.hpp>
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_profiler");
+
+namespace fs = std::filesystem;
+
+namespace polygon4
+{
+
+static double ms(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+LuaProfiler::LuaProfiler(int sample_interval)
+    : sample_interval(sample_interval > 0 ? sample_interval : 1000)
+{
+}
+
+LuaProfiler::FunctionStats &LuaProfiler::getFunction(lua_State *L, lua_Debug *ar)
+{
+    lua_getinfo(L, "Sn", ar);
+
+    // same function has the same source position, names depend on the caller
+    key = ar->short_src;
+    key += ":";
+    key += std::to_string(ar->linedefined);
+    if (ar->linedefined < 0 && ar->name)
+    {
+        // c functions have no position
+        key += ":";
+        key += ar->name;
+    }
+
+    auto &f = functions[key];
+    if (f.name.empty())
+    {
+        if (ar->what && strcmp(ar->what, "main") == 0)
+            f.name = "main";
+        else if (ar->name)
+            f.name = ar->name;
+        else
+            f.name = "?";
+        f.name += " (" + key + ")";
+        // ';' separates frames in collapsed stacks
+        std::replace(f.name.begin(), f.name.end(), ';', ':');
+    }
+    return f;
+}
+
+void LuaProfiler::onCall(lua_State *L, lua_Debug *ar, bool tail)
+{
+    auto now = Clock::now();
+    // tail call replaces the current frame, no return hook will come for it
+    if (tail && !stack.empty())
+        pop(now);
+    auto &f = getFunction(L, ar);
+    f.calls++;
+    stack.push_back({ &f, now });
+}
+
+void LuaProfiler::onReturn(lua_State *L, lua_Debug *ar)
+{
+    // profiler may be enabled in the middle of a call
+    if (!stack.empty())
+        pop(Clock::now());
+}
+
+void LuaProfiler::pop(Clock::time_point now)
+{
+    auto &fr = stack.back();
+    auto d = now - fr.start;
+    fr.f->inclusive += d;
+    fr.f->exclusive += d - fr.children;
+    stack.pop_back();
+    if (!stack.empty())
+        stack.back().children += d;
+}
+
+void LuaProfiler::onCount(lua_State *L, lua_Debug *ar)
+{
+    if (stack.empty())
+        return;
+    key.clear();
+    for (auto &fr : stack)
+    {
+        if (!key.empty())
+            key += ";";
+        key += fr.f->name;
+    }
+    samples[key]++;
+    stack.back().f->samples++;
+}
+
+void LuaProfiler::unwind(size_t depth)
+{
+    auto now = Clock::now();
+    while (stack.size() > depth)
+        pop(now);
+}
+
+void LuaProfiler::reset()
+{
+    functions.clear();
+    samples.clear();
+    stack.clear();
+}
+
+void LuaProfiler::writeCollapsed(std::ostream &o) const
+{
+    for (auto &[s, n] : samples)
+        o << s << " " << n << "\n";
+}
+
+void LuaProfiler::writeSummary(std::ostream &o) const
+{
+    std::vector<const FunctionStats *> v;
+    v.reserve(functions.size());
+    uint64_t total_samples = 0;
+    for (auto &[_, f] : functions)
+    {
+        v.push_back(&f);
+        total_samples += f.samples;
+    }
+    std::sort(v.begin(), v.end(), [](auto a, auto b) { return a->exclusive > b->exclusive; });
+
+    o << std::setw(12) << "excl, ms" << std::setw(12) << "incl, ms"
+        << std::setw(10) << "calls" << std::setw(10) << "samples" << "  function\n";
+    o << std::fixed << std::setprecision(3);
+    for (auto f : v)
+    {
+        o << std::setw(12) << ms(f->exclusive) << std::setw(12) << ms(f->inclusive)
+            << std::setw(10) << f->calls << std::setw(10) << f->samples << "  " << f->name << "\n";
+    }
+    o << "\n" << v.size() << " functions, " << total_samples << " samples"
+        << " (every " << sample_interval << " instructions)\n";
+}
+
+bool LuaProfiler::save(const fs::path &dir) const
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    char buf[32];
+    auto t = time(nullptr);
+    strftime(buf, sizeof(buf), "%Y%m%d_%H%M%S", localtime(&t));
+    auto base = dir / (std::string("lua_") + buf);
+
+    std::ofstream collapsed(fs::path(base) += ".folded");
+    std::ofstream summary(fs::path(base) += ".txt");
+    if (!collapsed || !summary)
+    {
+        LOG_ERROR(logger, "Cannot write lua profile to " << dir.string());
+        return false;
+    }
+    writeCollapsed(collapsed);
+    writeSummary(summary);
+    LOG_DEBUG(logger, "Lua profile is written to " << base.string() << ".*");
+    return true;
+}
+
+} // namespace polygon4
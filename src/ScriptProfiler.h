@@ -0,0 +1,93 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace polygon4
+{
+
+// lua profiler driven by call, return and count hooks
+// call/return hooks give per function counts and times,
+// count hook takes a stack sample every sample_interval instructions
+class LuaProfiler
+{
+    using Clock = std::chrono::steady_clock;
+
+public:
+    struct FunctionStats
+    {
+        std::string name;
+        uint64_t calls = 0;
+        Clock::duration inclusive{};
+        Clock::duration exclusive{};
+        uint64_t samples = 0;
+    };
+
+    LuaProfiler(int sample_interval = 1000);
+
+    int getSampleInterval() const { return sample_interval; }
+
+    void onCall(lua_State *L, lua_Debug *ar, bool tail = false);
+    void onReturn(lua_State *L, lua_Debug *ar);
+    void onCount(lua_State *L, lua_Debug *ar);
+
+    // errors unwind lua frames without return hooks,
+    // callers close the frames left after a failed pcall
+    size_t getDepth() const { return stack.size(); }
+    void unwind(size_t depth);
+
+    bool empty() const { return functions.empty(); }
+    void reset();
+
+    // flamegraph input: "f1;f2;f3 samples"
+    void writeCollapsed(std::ostream &o) const;
+    // functions sorted by exclusive time
+    void writeSummary(std::ostream &o) const;
+    // writes both files into dir, names start with the current time
+    bool save(const std::filesystem::path &dir) const;
+
+private:
+    struct Frame
+    {
+        FunctionStats *f;
+        Clock::time_point start;
+        Clock::duration children{};
+    };
+
+    int sample_interval;
+    std::unordered_map<std::string, FunctionStats> functions;
+    std::unordered_map<std::string, uint64_t> samples;
+    std::vector<Frame> stack;
+    std::string key;
+
+    FunctionStats &getFunction(lua_State *L, lua_Debug *ar);
+    void pop(Clock::time_point now);
+};
+
+} // namespace polygon4
@@ -0,0 +1,284 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptReferences.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <fstream>
+#include <iterator>
+
+#include <Polygon4/Engine.h>
+#include <Polygon4/Modification.h>
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_references");
+
+namespace polygon4
+{
+
+// api functions taking an id as the first argument
+static const std::unordered_map<std::string_view, ScriptReferences::Type> functions =
+{
+    { "AddMessage", ScriptReferences::Type::Message },
+    { "AddTheme", ScriptReferences::Type::Message },
+    { "ShowMessage", ScriptReferences::Type::Message },
+    { "AddJournalRecord", ScriptReferences::Type::Message },
+    { "MarkJournalRecord", ScriptReferences::Type::Message },
+    { "MarkJournalRecordCompleted", ScriptReferences::Type::Message },
+    { "AcceptQuest", ScriptReferences::Type::Message },
+
+    { "AddItem", ScriptReferences::Type::Item },
+    { "HasItem", ScriptReferences::Type::Item },
+    { "RemoveItem", ScriptReferences::Type::Item },
+    { "WaitItem", ScriptReferences::Type::Item },
+
+    { "RegisterQuest", ScriptReferences::Type::Object },
+
+    { "SetPointer", ScriptReferences::Type::Building },
+    { "WaitBuildingVisit", ScriptReferences::Type::Building },
+};
+
+const char *getReferenceTypeName(ScriptReferences::Type type)
+{
+    switch (type)
+    {
+    case ScriptReferences::Type::Message:
+        return "Message";
+    case ScriptReferences::Type::Item:
+        return "Item";
+    case ScriptReferences::Type::Object:
+        return "Object";
+    case ScriptReferences::Type::Building:
+        return "Building";
+    default:
+        break;
+    }
+    return "";
+}
+
+static bool is_ident(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+ScriptReferences::ScriptReferences(const detail::Modification *modification)
+    : modification(modification)
+{
+}
+
+detail::IObjectBase *ScriptReferences::resolve(Type type, std::string_view id_view) const
+{
+    std::string id(id_view);
+    auto find = [&id](const auto &m) -> detail::IObjectBase *
+    {
+        auto i = m.find(id);
+        return i == m.end() ? nullptr : i->second;
+    };
+
+    auto e = getEngine();
+    switch (type)
+    {
+    case Type::Message:
+        return find(e->getMessages());
+    case Type::Item:
+        return find(e->getItems());
+    case Type::Object:
+        return find(e->getObjects());
+    case Type::Building:
+        // scripts are scanned while the modification is loading, it is not current yet
+        if (auto m = modification ? modification : e->getCurrentModification())
+        {
+            for (auto &map : m->maps)
+            {
+                for (auto &b : map->buildings)
+                {
+                    if (b->text_id == id)
+                        return b;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+bool ScriptReferences::add(Type type, std::string_view id, detail::IObjectBase *o)
+{
+    if (o)
+    {
+        cache[(int)type].emplace(std::string(id), o);
+        return true;
+    }
+    auto &r = reported[(int)type];
+    if (r.find(id) != r.end())
+        return true;
+    r.emplace(id);
+    return false;
+}
+
+detail::IObjectBase *ScriptReferences::find(Type type, std::string_view id)
+{
+    auto &c = cache[(int)type];
+    auto i = c.find(id);
+    if (i != c.end())
+        return i->second;
+
+    auto o = resolve(type, id);
+    if (!add(type, id, o))
+        LOG_ERROR(logger, getReferenceTypeName(type) << " '" << id << "' was not found");
+    return o;
+}
+
+int ScriptReferences::scan(const path &fn)
+{
+    std::ifstream ifile(fn, std::ios::binary);
+    if (!ifile)
+        return 0;
+    std::string s((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+
+    int unknown = 0;
+    int line = 1;
+    size_t i = 0;
+
+    auto skip_to = [&](size_t end)
+    {
+        end = std::min(end, s.size());
+        line += (int)std::count(s.begin() + i, s.begin() + end, '\n');
+        i = end;
+    };
+    // level of a long bracket [[, [=[, ... at p or -1
+    auto long_bracket = [&](size_t p)
+    {
+        if (p >= s.size() || s[p] != '[')
+            return -1;
+        auto e = s.find_first_not_of('=', p + 1);
+        if (e == s.npos || s[e] != '[')
+            return -1;
+        return (int)(e - p - 1);
+    };
+    // long strings and comments end with the bracket of the same level
+    auto skip_long = [&](int level)
+    {
+        auto close = "]" + std::string(level, '=') + "]";
+        auto e = s.find(close, i + level + 2);
+        skip_to(e == s.npos ? e : e + close.size());
+    };
+    // returns false if the string has escapes, its value is not known then
+    auto read_string = [&](std::string_view &v)
+    {
+        auto q = s[i];
+        auto b = ++i;
+        bool plain = true;
+        while (i < s.size() && s[i] != q && s[i] != '\n')
+        {
+            if (s[i] == '\\')
+            {
+                plain = false;
+                i++;
+            }
+            i++;
+        }
+        v = std::string_view(s).substr(b, std::min(i, s.size()) - b);
+        skip_to(i + 1);
+        return plain;
+    };
+
+    while (i < s.size())
+    {
+        auto c = s[i];
+        if (c == '-' && s.compare(i, 2, "--") == 0)
+        {
+            // comments
+            skip_to(i + 2);
+            if (auto level = long_bracket(i); level >= 0)
+                skip_long(level);
+            else
+                skip_to(s.find('\n', i));
+            continue;
+        }
+        if (auto level = long_bracket(i); level >= 0)
+        {
+            // long strings, e.g. dialogue texts
+            skip_long(level);
+            continue;
+        }
+        if (c == '"' || c == '\'')
+        {
+            std::string_view v;
+            read_string(v);
+            continue;
+        }
+        if (!is_ident(c))
+        {
+            skip_to(i + 1);
+            continue;
+        }
+
+        auto b = i;
+        while (i < s.size() && is_ident(s[i]))
+            i++;
+        auto f = functions.find(std::string_view(s).substr(b, i - b));
+        if (f == functions.end())
+            continue;
+
+        // f("id") or f "id"
+        auto next = [&]()
+        {
+            while (i < s.size() && isspace((unsigned char)s[i]))
+                skip_to(i + 1);
+            return i < s.size() ? s[i] : 0;
+        };
+        if (next() == '(')
+        {
+            i++;
+            next();
+        }
+        if (i == s.size() || (s[i] != '"' && s[i] != '\''))
+            continue;
+
+        auto id_line = line;
+        std::string_view id;
+        if (!read_string(id))
+            continue;
+
+        auto &cache = this->cache[(int)f->second];
+        if (cache.find(id) != cache.end())
+            continue;
+        if (!add(f->second, id, resolve(f->second, id)))
+        {
+            LOG_ERROR(logger, fn.string() << ":" << id_line << ": " << getReferenceTypeName(f->second)
+                << " '" << id << "' was not found");
+            unknown++;
+        }
+    }
+    return unknown;
+}
+
+void ScriptReferences::clear()
+{
+    for (auto &c : cache)
+        c.clear();
+    for (auto &r : reported)
+        r.clear();
+}
+
+} // namespace polygon4
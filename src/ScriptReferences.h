@@ -0,0 +1,85 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <Polygon4/DataManager/Types.h>
+
+#include "Common.h"
+
+namespace polygon4
+{
+
+// ids of game objects used by scripts as string constants
+// found ids are resolved once and cached, unknown ones are reported once
+// and looked up again, the object may appear later
+// scripts are scanned on load, so typos show up before the call is made
+class ScriptReferences
+{
+public:
+    enum class Type
+    {
+        Message,
+        Item,
+        Object,
+        // map building of the modification
+        Building,
+
+        Max
+    };
+
+    // buildings are searched in the given modification,
+    // without it in the current one
+    ScriptReferences(const detail::Modification *modification = nullptr);
+
+    // null for unknown ids
+    detail::IObjectBase *find(Type type, std::string_view id);
+
+    // resolves constant string arguments of api calls in the script source
+    // returns the number of unknown ids
+    int scan(const path &fn);
+
+    void clear();
+
+private:
+    struct Hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    using Cache = std::unordered_map<std::string, detail::IObjectBase *, Hash, std::equal_to<>>;
+
+    const detail::Modification *modification;
+    Cache cache[(int)Type::Max];
+    std::unordered_set<std::string, Hash, std::equal_to<>> reported[(int)Type::Max];
+
+    detail::IObjectBase *resolve(Type type, std::string_view id) const;
+    // caches found objects, returns false for a new unknown id
+    bool add(Type type, std::string_view id, detail::IObjectBase *o);
+};
+
+const char *getReferenceTypeName(ScriptReferences::Type type);
+
+} // namespace polygon4
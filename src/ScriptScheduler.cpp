@@ -0,0 +1,316 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptScheduler.h"
+
+#include <tuple>
+
+#include <Polygon4/Engine.h>
+#include <Polygon4/Mechanoid.h>
+
+#include "ScriptLua.h"
+#include "ScriptProfiler.h"
+
+#include "ScriptLuaCompat.h"
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_scheduler");
+
+namespace polygon4
+{
+
+// finished threads kept for reuse
+static const size_t max_free_threads = 16;
+
+LuaScheduler::LuaScheduler(ScriptLuaContext &context)
+    : context(context), L(context.getState())
+{
+}
+
+void LuaScheduler::open()
+{
+    lua_register(L, "WaitSeconds", waitSeconds);
+    lua_register(L, "WaitBuildingVisit", waitBuildingVisit);
+    lua_register(L, "WaitItem", waitItem);
+}
+
+bool LuaScheduler::start(ScriptLua *script, int nargs, std::string_view fn, bool can_wait)
+{
+    lua_State *co;
+    int ref;
+    if (!threads.empty())
+    {
+        std::tie(co, ref) = threads.back();
+        threads.pop_back();
+    }
+    else
+    {
+        co = lua_newthread(L);
+        ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_xmove(L, co, nargs + 1);
+
+    auto id = next_id++;
+    auto &c = coroutines[id];
+    c.script = script;
+    c.L = co;
+    c.ref = ref;
+    c.fn = fn;
+    c.can_wait = can_wait;
+
+    if (resume(c, nargs))
+    {
+        if (!c.L)
+        {
+            // finished without waiting
+            coroutines.erase(id);
+            return true;
+        }
+        c.data = script->data;
+        schedule(id, c);
+        return true;
+    }
+    coroutines.erase(id);
+    return false;
+}
+
+bool LuaScheduler::resume(Coroutine &c, int nargs)
+{
+    // threads keep hooks from the time they were created
+    lua_sethook(c.L, lua_gethook(L), lua_gethookmask(L), lua_gethookcount(L));
+
+    auto prev = running;
+    running = &c;
+    pending = Wait();
+    auto profiler = context.getProfiler();
+    auto depth = profiler ? profiler->getDepth() : 0;
+    auto prev_data = context.getCurrentData();
+
+    context.setCurrentData(&c.script->data);
+    context.beginCall();
+#if LUA_VERSION_NUM >= 504
+    int nres;
+    auto r = lua_resume(c.L, L, nargs, &nres);
+#elif LUA_VERSION_NUM >= 502
+    auto r = lua_resume(c.L, L, nargs);
+#else
+    auto r = lua_resume(c.L, nargs);
+#endif
+    context.endCall();
+    context.setCurrentData(prev_data);
+    running = prev;
+
+    // yields and errors leave frames without return hooks
+    if (profiler)
+        profiler->unwind(depth);
+
+    switch (r)
+    {
+    case LUA_YIELD:
+        lua_settop(c.L, 0);
+        c.wait = std::move(pending);
+        return true;
+    case LUA_OK:
+        c.wait = Wait();
+        release(c, true);
+        return true;
+    default:
+        LOG_ERROR(logger, "Error during call to '" << c.fn << "': " << lua_tostring(c.L, -1));
+        context.countError();
+        release(c, false);
+        return false;
+    }
+}
+
+void LuaScheduler::schedule(Id id, Coroutine &c)
+{
+    switch (c.wait.type)
+    {
+    case WaitType::Time:
+        timers.emplace(c.wait.time, id);
+        break;
+    case WaitType::BuildingVisit:
+        building_waits.emplace(c.wait.name, id);
+        break;
+    case WaitType::Item:
+        item_waits.emplace(c.wait.item, id);
+        break;
+    default:
+        // plain yield, continue on the next update
+        ready.push_back(id);
+        break;
+    }
+}
+
+void LuaScheduler::release(Coroutine &c, bool reuse)
+{
+    if (reuse && threads.size() < max_free_threads)
+    {
+        lua_settop(c.L, 0);
+        threads.emplace_back(c.L, c.ref);
+    }
+    else
+        luaL_unref(L, LUA_REGISTRYINDEX, c.ref);
+    c.L = nullptr;
+}
+
+void LuaScheduler::update(int64_t playtime)
+{
+    for (auto i = timers.begin(); i != timers.end() && i->first <= playtime; i = timers.erase(i))
+        ready.push_back(i->second);
+    if (ready.empty())
+        return;
+
+    // resumed coroutines may schedule new ready ones
+    auto ids = std::move(ready);
+    ready.clear();
+    for (auto id : ids)
+    {
+        auto i = coroutines.find(id);
+        if (i == coroutines.end())
+            continue;
+        auto &c = i->second;
+
+        // first argument of the entry point points to script data
+        auto s = c.script;
+        auto saved = s->data;
+        s->data = c.data;
+        auto r = resume(c, 0);
+        if (r && c.L)
+        {
+            c.data = s->data;
+            schedule(id, c);
+        }
+        else
+            coroutines.erase(id);
+        s->data = saved;
+    }
+}
+
+void LuaScheduler::onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building)
+{
+    auto [b, e] = building_waits.equal_range(building->text_id.toString());
+    for (auto i = b; i != e;)
+    {
+        auto c = coroutines.find(i->second);
+        if (c != coroutines.end() && c->second.data.player != player)
+        {
+            ++i;
+            continue;
+        }
+        if (c != coroutines.end())
+            ready.push_back(i->second);
+        i = building_waits.erase(i);
+    }
+}
+
+void LuaScheduler::onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item)
+{
+    auto [b, e] = item_waits.equal_range(item);
+    for (auto i = b; i != e;)
+    {
+        auto c = coroutines.find(i->second);
+        if (c == coroutines.end())
+        {
+            i = item_waits.erase(i);
+            continue;
+        }
+        auto &d = c->second.data;
+        if (d.player != player ||
+            !d.player->mechanoid->getConfiguration()->hasItem(item, c->second.wait.quantity))
+        {
+            ++i;
+            continue;
+        }
+        ready.push_back(i->second);
+        i = item_waits.erase(i);
+    }
+}
+
+void LuaScheduler::cancel(const ScriptLua *script)
+{
+    for (auto i = coroutines.begin(); i != coroutines.end();)
+    {
+        if (i->second.script != script || &i->second == running)
+        {
+            ++i;
+            continue;
+        }
+        release(i->second, false);
+        i = coroutines.erase(i);
+    }
+}
+
+LuaScheduler *LuaScheduler::get(lua_State *L, const char *wait)
+{
+    // raises a lua error if the coroutine cannot wait
+    auto c = ScriptLuaContext::get(L);
+    auto s = c ? &c->getScheduler() : nullptr;
+    if (!s || !s->running || s->running->L != L)
+        luaL_error(L, "%s() can be used only in script entry points", wait);
+    // the wait would be lost on save/load
+    if (!s->running->can_wait)
+        luaL_error(L, "%s() cannot be used in %s()", wait, s->running->fn.c_str());
+    return s;
+}
+
+// wait functions yield with a lua error or lua_yield,
+// so they keep no objects with destructors on the stack
+
+int LuaScheduler::waitSeconds(lua_State *L)
+{
+    auto s = get(L, "WaitSeconds");
+    auto seconds = luaL_checknumber(L, 1);
+    s->pending.type = WaitType::Time;
+    s->pending.time = (int64_t)GET_SETTINGS().playtime + (int64_t)(seconds * 1000);
+    return lua_yield(L, 0);
+}
+
+int LuaScheduler::waitBuildingVisit(lua_State *L)
+{
+    auto s = get(L, "WaitBuildingVisit");
+    s->pending.type = WaitType::BuildingVisit;
+    s->pending.name = luaL_checkstring(L, 1);
+    return lua_yield(L, 0);
+}
+
+int LuaScheduler::waitItem(lua_State *L)
+{
+    auto s = get(L, "WaitItem");
+    s->pending.type = WaitType::Item;
+    s->pending.name = luaL_checkstring(L, 1);
+    s->pending.quantity = (int)luaL_optinteger(L, 2, 1);
+
+    auto &items = getEngine()->getItems();
+    auto i = items.find(s->pending.name);
+    if (i == items.end())
+        return luaL_error(L, "Item '%s' was not found", lua_tostring(L, 1));
+    s->pending.item = i->second;
+
+    // nothing to wait for
+    auto player = s->running->script->data.player;
+    if (player && player->mechanoid->getConfiguration()->hasItem(s->pending.item, s->pending.quantity))
+    {
+        s->pending = Wait();
+        return 0;
+    }
+    return lua_yield(L, 0);
+}
+
+} // namespace polygon4
@@ -0,0 +1,127 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Script.h"
+
+struct lua_State;
+
+namespace polygon4
+{
+
+class ScriptLua;
+class ScriptLuaContext;
+
+// runs script entry points as lua coroutines
+// WaitSeconds(), WaitBuildingVisit() and WaitItem() yield the coroutine,
+// it is resumed when the event fires, so waiting quests cost nothing
+// waits are not saved with the game, after load the rest of the function never runs,
+// so RegisterQuests() cannot wait and quest progress must be kept in variables and timers
+class LuaScheduler
+{
+public:
+    enum class WaitType
+    {
+        None,
+        Time,
+        BuildingVisit,
+        Item,
+    };
+
+    struct Wait
+    {
+        WaitType type = WaitType::None;
+        // playtime, ms
+        int64_t time = 0;
+        // building or item text id
+        std::string name;
+        const detail::IObjectBase *item = nullptr;
+        int quantity = 1;
+    };
+
+    LuaScheduler(ScriptLuaContext &context);
+
+    // registers Wait* functions in globals
+    void open();
+
+    // function and nargs arguments are on the top of the main stack
+    // returns false on error
+    bool start(ScriptLua *script, int nargs, std::string_view fn, bool can_wait = true);
+
+    // resumes coroutines that are ready or whose time has come
+    void update(int64_t playtime);
+    void onBuildingVisit(const detail::ModificationPlayer *player, const detail::ModificationMapBuilding *building);
+    void onItemAdded(const detail::ModificationPlayer *player, const detail::IObjectBase *item);
+
+    // drops coroutines of a destroyed script
+    void cancel(const ScriptLua *script);
+
+    size_t getWaitingCount() const { return coroutines.size(); }
+
+private:
+    using Id = uint64_t;
+
+    struct Coroutine
+    {
+        ScriptLua *script = nullptr;
+        // null when the coroutine is finished
+        lua_State *L = nullptr;
+        int ref = 0;
+        std::string fn;
+        bool can_wait = true;
+        // data of the call that started the coroutine
+        ScriptData data;
+        Wait wait;
+    };
+
+    ScriptLuaContext &context;
+    lua_State *L;
+    Id next_id = 0;
+    std::unordered_map<Id, Coroutine> coroutines;
+    // finished threads for reuse
+    std::vector<std::pair<lua_State *, int>> threads;
+
+    std::multimap<int64_t, Id> timers;
+    std::unordered_multimap<std::string, Id> building_waits;
+    std::unordered_multimap<const detail::IObjectBase *, Id> item_waits;
+    std::vector<Id> ready;
+
+    // coroutine being resumed and the wait it asked for
+    Coroutine *running = nullptr;
+    Wait pending;
+
+    bool resume(Coroutine &c, int nargs);
+    void schedule(Id id, Coroutine &c);
+    void release(Coroutine &c, bool reuse);
+
+    static LuaScheduler *get(lua_State *L, const char *wait);
+    static int yield(lua_State *L, Wait w);
+    static int waitSeconds(lua_State *L);
+    static int waitBuildingVisit(lua_State *L);
+    static int waitItem(lua_State *L);
+};
+
+} // namespace polygon4
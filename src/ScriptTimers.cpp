@@ -0,0 +1,162 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptTimers.h"
+
+#include "ScriptVariables.h"
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_timers");
+
+namespace polygon4
+{
+
+static const std::string timer_tag = "timer";
+
+// "timer" or "timer:<script>:<callback>"
+static bool is_timer(const std::string &text)
+{
+    return text.compare(0, timer_tag.size(), timer_tag) == 0 &&
+        (text.size() == timer_tag.size() || text[timer_tag.size()] == ':');
+}
+
+ScriptTimers::ScriptTimers(ScriptVariables &variables)
+    : variables(variables)
+{
+}
+
+void ScriptTimers::start(detail::ModificationPlayer *player, const std::string &name, int64_t time,
+    const std::string &script, const std::string &callback)
+{
+    Timer t;
+    t.time = time;
+    t.script = script;
+    t.callback = callback;
+    add(player, name, t);
+    save(player, name, t);
+}
+
+void ScriptTimers::add(detail::ModificationPlayer *player, const std::string &name, const Timer &t)
+{
+    auto &pt = timers[player][name];
+    (Timer &)pt = t;
+    pt.generation = ++generation;
+    if (!t.callback.empty())
+        queue.push({ t.time, player, name, pt.generation });
+}
+
+void ScriptTimers::stop(detail::ModificationPlayer *player, const std::string &name)
+{
+    auto p = timers.find(player);
+    if (p == timers.end())
+        return;
+    // queue entry is dropped when it comes out
+    p->second.erase(name);
+    variables.erase(player, name);
+}
+
+const ScriptTimers::Timer *ScriptTimers::find(const detail::ModificationPlayer *player, const std::string &name) const
+{
+    auto p = timers.find(player);
+    if (p == timers.end())
+        return nullptr;
+    auto t = p->second.find(name);
+    if (t == p->second.end())
+        return nullptr;
+    return &t->second;
+}
+
+void ScriptTimers::save(detail::ModificationPlayer *player, const std::string &name, const Timer &t)
+{
+    auto v = variables.get(player, name);
+    v->value_int = (int)t.time;
+    if (t.callback.empty())
+        v->value_text = timer_tag;
+    else
+        v->value_text = timer_tag + ":" + t.script + ":" + t.callback;
+}
+
+void ScriptTimers::load(detail::ModificationPlayer *player)
+{
+    timers.erase(player);
+    for (auto &v : player->variables)
+    {
+        auto text = (std::string)v->value_text;
+        if (!is_timer(text))
+            continue;
+
+        Timer t;
+        t.time = v->value_int;
+        if (text.size() > timer_tag.size())
+        {
+            // timer:<script>:<callback>, callback names contain no ':'
+            auto p1 = timer_tag.size();
+            auto p2 = text.rfind(':');
+            if (p2 == p1)
+            {
+                LOG_ERROR(logger, "Bad timer variable: " << (std::string)v->key << " = " << text);
+                continue;
+            }
+            t.script = text.substr(p1 + 1, p2 - p1 - 1);
+            t.callback = text.substr(p2 + 1);
+        }
+        add(player, (std::string)v->key, t);
+    }
+}
+
+void ScriptTimers::clear()
+{
+    queue = {};
+    timers.clear();
+}
+
+void ScriptTimers::update(int64_t playtime, const Callback &f)
+{
+    while (!queue.empty() && queue.top().time <= playtime)
+    {
+        auto e = queue.top();
+        queue.pop();
+
+        auto p = timers.find(e.player);
+        if (p == timers.end())
+            continue;
+        auto i = p->second.find(e.name);
+        if (i == p->second.end() || i->second.generation != e.generation)
+            continue;
+
+        // SetVar() or UnsetVar() on the timer name replaces the timer
+        auto v = variables.find(e.player, e.name);
+        if (!v || v->value_int != (int)i->second.time || !is_timer((std::string)v->value_text))
+        {
+            p->second.erase(i);
+            continue;
+        }
+
+        // timer stays for IsTimerExpired(), callback is not called again after load
+        Timer t = i->second;
+        i->second.script.clear();
+        i->second.callback.clear();
+        save(e.player, e.name, i->second);
+
+        LOG_TRACE(logger, "Timer " << e.name << " expired, calling " << t.script << ":" << t.callback);
+        f(e.player, e.name, t);
+    }
+}
+
+} // namespace polygon4
@@ -0,0 +1,95 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Polygon4/DataManager/Types.h>
+
+namespace polygon4
+{
+
+class ScriptVariables;
+
+// named player timers on playtime (ms)
+// every timer is mirrored in a player variable, so timers are saved with the game:
+// value_int is the deadline, value_text is "timer" or "timer:<script>:<callback>"
+// the variable stays the timer state, scripts may overwrite or unset it
+class ScriptTimers
+{
+public:
+    struct Timer
+    {
+        int64_t time = 0;
+        // callback is called once when the timer expires
+        std::string script;
+        std::string callback;
+    };
+
+    using Callback = std::function<void(detail::ModificationPlayer *player, const std::string &name, const Timer &t)>;
+
+    ScriptTimers(ScriptVariables &variables);
+
+    void start(detail::ModificationPlayer *player, const std::string &name, int64_t time,
+        const std::string &script = {}, const std::string &callback = {});
+    void stop(detail::ModificationPlayer *player, const std::string &name);
+    const Timer *find(const detail::ModificationPlayer *player, const std::string &name) const;
+
+    // rebuilds player timers from variables after load
+    void load(detail::ModificationPlayer *player);
+    void clear();
+
+    // calls f for every expired timer with a callback
+    // timers whose variable was changed by scripts are dropped
+    void update(int64_t playtime, const Callback &f);
+
+    size_t size() const { return queue.size(); }
+
+private:
+    struct Entry
+    {
+        int64_t time;
+        detail::ModificationPlayer *player;
+        std::string name;
+        uint64_t generation;
+
+        bool operator>(const Entry &rhs) const { return time > rhs.time; }
+    };
+
+    struct PlayerTimer : Timer
+    {
+        // queue entries of restarted timers are skipped
+        uint64_t generation = 0;
+    };
+
+    ScriptVariables &variables;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    std::unordered_map<const detail::ModificationPlayer *, std::unordered_map<std::string, PlayerTimer>> timers;
+    uint64_t generation = 0;
+
+    void add(detail::ModificationPlayer *player, const std::string &name, const Timer &t);
+    void save(detail::ModificationPlayer *player, const std::string &name, const Timer &t);
+};
+
+} // namespace polygon4
@@ -0,0 +1,318 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptTrace.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace polygon4
+{
+
+static const char trace_magic[8] = { 'P', '4', 'T', 'R', 'A', 'C', 'E', 0 };
+static const uint32_t trace_version = 1;
+
+enum class TraceRecord : uint8_t
+{
+    Call = 1,
+    Query,
+    Return,
+};
+
+enum class TraceValueType : uint8_t
+{
+    Nil,
+    Bool,
+    Number,
+    String,
+};
+
+static void write_varint(std::string &b, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        b += (char)(v | 0x80);
+        v >>= 7;
+    }
+    b += (char)v;
+}
+
+static void write_int(std::string &b, int64_t v)
+{
+    write_varint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static void write_string(std::string &b, std::string_view s)
+{
+    write_varint(b, s.size());
+    b += s;
+}
+
+static void write_double(std::string &b, double v)
+{
+    char d[sizeof(v)];
+    memcpy(d, &v, sizeof(v));
+    b.append(d, sizeof(v));
+}
+
+ScriptTraceWriter::ScriptTraceWriter(const path &fn, const std::string &snapshot)
+{
+    fs::create_directories(fn.parent_path());
+    ofile.open(fn, std::ios::binary | std::ios::trunc);
+    if (!ofile)
+        throw std::runtime_error("Cannot open trace file: " + fn.string());
+
+    buffer.append(trace_magic, sizeof(trace_magic));
+    for (int i = 0; i < 4; i++)
+        buffer += (char)(trace_version >> (i * 8));
+    write_string(buffer, snapshot);
+}
+
+ScriptTraceWriter::~ScriptTraceWriter()
+{
+    flush();
+}
+
+void ScriptTraceWriter::flush()
+{
+    ofile.write(buffer.data(), buffer.size());
+    ofile.flush();
+    buffer.clear();
+}
+
+void ScriptTraceWriter::beginCall(const TraceCall &c)
+{
+    buffer += (char)TraceRecord::Call;
+    write_string(buffer, c.script);
+    write_string(buffer, c.function);
+    write_int(buffer, c.player);
+    write_string(buffer, c.building);
+    write_int(buffer, c.playtime);
+    write_varint(buffer, c.args.size());
+    for (auto &a : c.args)
+    {
+        buffer += (char)a.index();
+        if (auto v = std::get_if<bool>(&a))
+            buffer += (char)*v;
+        else if (auto v = std::get_if<double>(&a))
+            write_double(buffer, *v);
+        else if (auto v = std::get_if<std::string>(&a))
+            write_string(buffer, *v);
+    }
+    calls++;
+    depth++;
+}
+
+void ScriptTraceWriter::endCall(int64_t time_ns, bool ok)
+{
+    buffer += (char)TraceRecord::Return;
+    write_varint(buffer, time_ns > 0 ? time_ns : 0);
+    buffer += (char)ok;
+
+    // keep the file usable if the game stops, but do not write on every nested call
+    if (--depth == 0 && buffer.size() > 64 * 1024)
+        flush();
+}
+
+void ScriptTraceWriter::onQuery(std::string_view name, std::string_view arg, double result)
+{
+    buffer += (char)TraceRecord::Query;
+    write_string(buffer, name);
+    write_string(buffer, arg);
+    write_double(buffer, result);
+}
+
+namespace
+{
+
+struct TraceInput
+{
+    const std::string &data;
+    size_t pos = 0;
+
+    void check(size_t n) const
+    {
+        if (data.size() - pos < n)
+            throw std::runtime_error("Unexpected end of trace file");
+    }
+
+    uint8_t byte()
+    {
+        check(1);
+        return (uint8_t)data[pos++];
+    }
+
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            auto b = byte();
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        throw std::runtime_error("Bad varint in trace file");
+    }
+
+    int64_t integer()
+    {
+        auto v = varint();
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    std::string string()
+    {
+        auto n = varint();
+        check(n);
+        auto s = data.substr(pos, n);
+        pos += n;
+        return s;
+    }
+
+    double number()
+    {
+        double v;
+        check(sizeof(v));
+        memcpy(&v, data.data() + pos, sizeof(v));
+        pos += sizeof(v);
+        return v;
+    }
+};
+
+} // namespace
+
+ScriptTraceReader::ScriptTraceReader(const path &fn)
+{
+    std::ifstream ifile(fn, std::ios::binary);
+    if (!ifile)
+        throw std::runtime_error("Cannot open trace file: " + fn.string());
+    std::string data((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+
+    TraceInput in{ data };
+    in.check(sizeof(trace_magic) + 4);
+    if (memcmp(data.data(), trace_magic, sizeof(trace_magic)) != 0)
+        throw std::runtime_error("Not a script trace: " + fn.string());
+    in.pos += sizeof(trace_magic);
+    uint32_t version = 0;
+    for (int i = 0; i < 4; i++)
+        version |= (uint32_t)in.byte() << (i * 8);
+    if (version != trace_version)
+        throw std::runtime_error("Unsupported script trace version " + std::to_string(version));
+    snapshot = in.string();
+
+    // indices of open calls
+    std::vector<size_t> open;
+    while (in.pos < data.size())
+    {
+        switch ((TraceRecord)in.byte())
+        {
+        case TraceRecord::Call:
+        {
+            TraceCall c;
+            c.script = in.string();
+            c.function = in.string();
+            c.player = in.integer();
+            c.building = in.string();
+            c.playtime = in.integer();
+            auto n = in.varint();
+            for (uint64_t i = 0; i < n; i++)
+            {
+                switch ((TraceValueType)in.byte())
+                {
+                case TraceValueType::Nil:
+                    c.args.emplace_back();
+                    break;
+                case TraceValueType::Bool:
+                    c.args.emplace_back(in.byte() != 0);
+                    break;
+                case TraceValueType::Number:
+                    c.args.emplace_back(in.number());
+                    break;
+                case TraceValueType::String:
+                    c.args.emplace_back(in.string());
+                    break;
+                default:
+                    throw std::runtime_error("Bad argument type in trace file");
+                }
+            }
+            c.depth = (int)open.size();
+            open.push_back(calls.size());
+            calls.push_back(std::move(c));
+            break;
+        }
+        case TraceRecord::Query:
+        {
+            TraceQuery q;
+            q.name = in.string();
+            q.arg = in.string();
+            q.result = in.number();
+            // queries of resumed coroutines are outside of any call
+            if (!open.empty())
+                calls[open.front()].queries.push_back(std::move(q));
+            break;
+        }
+        case TraceRecord::Return:
+        {
+            auto time_ns = (int64_t)in.varint();
+            auto ok = in.byte() != 0;
+            if (open.empty())
+                throw std::runtime_error("Unmatched return in trace file");
+            auto &c = calls[open.back()];
+            c.time_ns = time_ns;
+            c.ok = ok;
+            open.pop_back();
+            break;
+        }
+        default:
+            throw std::runtime_error("Bad record in trace file");
+        }
+    }
+    // the game stopped in the middle of a call, drop it
+    if (!open.empty())
+        calls.resize(open.front());
+}
+
+void ScriptTraceChecker::expect(const std::vector<TraceQuery> &queries)
+{
+    expected = &queries;
+    next = 0;
+    mismatches = 0;
+}
+
+size_t ScriptTraceChecker::getMismatches() const
+{
+    // missing queries
+    return mismatches + (expected ? expected->size() - std::min(next, expected->size()) : 0);
+}
+
+void ScriptTraceChecker::onQuery(std::string_view name, std::string_view arg, double result)
+{
+    if (!expected || next >= expected->size())
+    {
+        mismatches++;
+        return;
+    }
+    auto &q = (*expected)[next++];
+    if (q.name != name || q.arg != arg || q.result != result)
+        mismatches++;
+}
+
+} // namespace polygon4
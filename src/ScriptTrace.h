@@ -0,0 +1,131 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "Common.h"
+
+namespace polygon4
+{
+
+// script call traces
+// file: "P4TRACE\0", u32 version, snapshot name, then records tagged with one byte
+//     call:   script, function, player, building, playtime, arguments
+//     query:  name, argument, result
+//     return: time in ns, ok
+// integers are varints (signed ones zigzag encoded), strings are length prefixed
+// nested calls and queries are written between call and return of the outer call
+
+using TraceValue = std::variant<std::monostate, bool, double, std::string>;
+
+struct TraceQuery
+{
+    std::string name;
+    std::string arg;
+    double result = 0;
+};
+
+struct TraceCall
+{
+    std::string script;
+    std::string function;
+    // index in modification players, -1 - no player
+    int64_t player = -1;
+    // text id of the map building, empty - no building
+    std::string building;
+    int64_t playtime = 0;
+    std::vector<TraceValue> args;
+
+    // filled by the reader
+    // nested calls have depth > 0, their queries belong to the outermost call
+    int depth = 0;
+    std::vector<TraceQuery> queries;
+    int64_t time_ns = 0;
+    bool ok = true;
+};
+
+// receives results of ScriptData queries
+class ScriptTrace
+{
+public:
+    virtual ~ScriptTrace() = default;
+
+    virtual void onQuery(std::string_view name, std::string_view arg, double result) = 0;
+};
+
+class ScriptTraceWriter : public ScriptTrace
+{
+public:
+    // snapshot is the name of the save the trace starts from
+    ScriptTraceWriter(const path &fn, const std::string &snapshot);
+    ~ScriptTraceWriter();
+
+    void beginCall(const TraceCall &c);
+    void endCall(int64_t time_ns, bool ok);
+    virtual void onQuery(std::string_view name, std::string_view arg, double result) override;
+
+    size_t getCallCount() const { return calls; }
+
+private:
+    std::ofstream ofile;
+    std::string buffer;
+    size_t calls = 0;
+    int depth = 0;
+
+    void flush();
+};
+
+class ScriptTraceReader
+{
+public:
+    // throws on bad files
+    ScriptTraceReader(const path &fn);
+
+    const std::string &getSnapshot() const { return snapshot; }
+    // in the order of calls
+    const std::vector<TraceCall> &getCalls() const { return calls; }
+
+private:
+    std::string snapshot;
+    std::vector<TraceCall> calls;
+};
+
+// compares queries made while replaying a call with the recorded ones
+class ScriptTraceChecker : public ScriptTrace
+{
+public:
+    void expect(const std::vector<TraceQuery> &queries);
+    // number of differences since expect()
+    size_t getMismatches() const;
+
+    virtual void onQuery(std::string_view name, std::string_view arg, double result) override;
+
+private:
+    const std::vector<TraceQuery> *expected = nullptr;
+    size_t next = 0;
+    size_t mismatches = 0;
+};
+
+} // namespace polygon4
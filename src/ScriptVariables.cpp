@@ -0,0 +1,88 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptVariables.h"
+
+#include <algorithm>
+
+#include <Polygon4/Engine.h>
+
+namespace polygon4
+{
+
+ScriptVariables::Index &ScriptVariables::getIndex(detail::ModificationPlayer *player)
+{
+    auto i = players.find(player);
+    if (i != players.end())
+        return i->second;
+
+    auto &index = players[player];
+    index.reserve(player->variables.size());
+    for (auto &v : player->variables)
+    {
+        // the first of duplicate keys wins, as with the linear search
+        detail::ScriptVariable *sv = v;
+        index.emplace((std::string)sv->key, sv);
+    }
+    return index;
+}
+
+detail::ScriptVariable *ScriptVariables::find(detail::ModificationPlayer *player, std::string_view key)
+{
+    auto &index = getIndex(player);
+    auto i = index.find(key);
+    return i == index.end() ? nullptr : i->second;
+}
+
+detail::ScriptVariable *ScriptVariables::get(detail::ModificationPlayer *player, std::string_view key)
+{
+    auto &index = getIndex(player);
+    auto i = index.find(key);
+    if (i != index.end())
+        return i->second;
+
+    std::string k(key);
+    auto sv = GET_STORAGE()->scriptVariables.createAtEnd();
+    sv->player = player;
+    sv->key = k;
+    player->variables.insert(sv);
+    detail::ScriptVariable *p = sv;
+    index.emplace(std::move(k), p);
+    return p;
+}
+
+void ScriptVariables::erase(detail::ModificationPlayer *player, std::string_view key)
+{
+    auto &index = getIndex(player);
+    auto i = index.find(key);
+    if (i == index.end())
+        return;
+    auto p = i->second;
+    index.erase(i);
+
+    // storage has no index, but unset is rare compared to lookups
+    auto v = std::find_if(player->variables.begin(), player->variables.end(), [p](const auto &v)
+    {
+        return (detail::ScriptVariable *)v == p;
+    });
+    if (v != player->variables.end())
+        player->variables.erase(v);
+}
+
+} // namespace polygon4
@@ -0,0 +1,57 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <Polygon4/DataManager/Types.h>
+
+namespace polygon4
+{
+
+// hashed index over player script variables
+// player->variables stays the storage, the index of a player is built on first access
+class ScriptVariables
+{
+public:
+    detail::ScriptVariable *find(detail::ModificationPlayer *player, std::string_view key);
+    // creates a variable if it does not exist
+    detail::ScriptVariable *get(detail::ModificationPlayer *player, std::string_view key);
+    void erase(detail::ModificationPlayer *player, std::string_view key);
+
+    void clear() { players.clear(); }
+
+private:
+    struct Hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    using Index = std::unordered_map<std::string, detail::ScriptVariable *, Hash, std::equal_to<>>;
+
+    std::unordered_map<const detail::ModificationPlayer *, Index> players;
+
+    Index &getIndex(detail::ModificationPlayer *player);
+};
+
+} // namespace polygon4
@@ -0,0 +1,177 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ScriptWatcher.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <tools/Logger.h>
+DECLARE_STATIC_LOGGER(logger, "script_watcher");
+
+namespace polygon4
+{
+
+ScriptWatcher::ScriptWatcher(const path &dir, int poll_interval_ms)
+    : dir(dir), poll_interval(poll_interval_ms > 0 ? poll_interval_ms : 1000)
+{
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd != -1)
+    {
+        addWatches(dir);
+        if (watches.empty())
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+#endif
+    if (fd == -1)
+    {
+        LOG_DEBUG(logger, "Polling script directory: " << dir.string());
+        scan(nullptr);
+        last_poll = std::chrono::steady_clock::now();
+    }
+}
+
+ScriptWatcher::~ScriptWatcher()
+{
+#ifdef __linux__
+    if (fd != -1)
+        close(fd);
+#endif
+}
+
+void ScriptWatcher::addWatches(const path &d)
+{
+#ifdef __linux__
+    auto add = [this](const path &p)
+    {
+        auto wd = inotify_add_watch(fd, p.string().c_str(),
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF);
+        if (wd == -1)
+            LOG_WARN(logger, "Cannot watch directory: " << p.string());
+        else
+            watches[wd] = p;
+    };
+
+    std::error_code ec;
+    if (!fs::is_directory(d, ec))
+        return;
+    add(d);
+    for (auto i = fs::recursive_directory_iterator(d, ec); !ec && i != fs::recursive_directory_iterator(); i.increment(ec))
+    {
+        if (i->is_directory(ec))
+            add(i->path());
+    }
+#endif
+}
+
+void ScriptWatcher::readEvents(std::vector<path> &changes)
+{
+#ifdef __linux__
+    alignas(inotify_event) char buf[4096];
+    while (1)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (auto p = buf; p < buf + n;)
+        {
+            auto e = (const inotify_event *)p;
+            p += sizeof(inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW)
+            {
+                changes.push_back(dir);
+                continue;
+            }
+            if (e->mask & IN_IGNORED)
+            {
+                watches.erase(e->wd);
+                continue;
+            }
+            auto w = watches.find(e->wd);
+            if (w == watches.end() || !e->len)
+                continue;
+            auto f = w->second / e->name;
+            if (e->mask & IN_ISDIR)
+            {
+                // new directory may already contain files
+                if (e->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    addWatches(f);
+                    changes.push_back(dir);
+                }
+                continue;
+            }
+            // files are reported when they are written or moved in, not when created
+            if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                changes.push_back(f);
+        }
+    }
+#endif
+}
+
+void ScriptWatcher::scan(std::vector<path> *changes)
+{
+    std::error_code ec;
+    std::unordered_map<std::string, fs::file_time_type> current;
+    current.reserve(files.size());
+    for (auto i = fs::recursive_directory_iterator(dir, ec); !ec && i != fs::recursive_directory_iterator(); i.increment(ec))
+    {
+        if (!i->is_regular_file(ec))
+            continue;
+        auto t = i->last_write_time(ec);
+        auto s = i->path().string();
+        if (changes)
+        {
+            auto f = files.find(s);
+            if (f == files.end() || f->second != t)
+                changes->push_back(i->path());
+        }
+        current.emplace(std::move(s), t);
+    }
+    files = std::move(current);
+}
+
+std::vector<path> ScriptWatcher::getChanges()
+{
+    std::vector<path> changes;
+    if (fd != -1)
+        readEvents(changes);
+    else
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_poll < poll_interval)
+            return changes;
+        last_poll = now;
+        scan(&changes);
+    }
+    std::sort(changes.begin(), changes.end());
+    changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+    return changes;
+}
+
+} // namespace polygon4
@@ -0,0 +1,62 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+
+namespace polygon4
+{
+
+// reports changed files under a directory
+// inotify is used on linux, other systems and failed inotify setups poll mtimes
+class ScriptWatcher
+{
+public:
+    ScriptWatcher(const path &dir, int poll_interval_ms = 1000);
+    ~ScriptWatcher();
+
+    // files changed since the previous call, cheap to call every frame
+    // the directory itself is returned when events were lost
+    std::vector<path> getChanges();
+
+    const path &getDirectory() const { return dir; }
+    bool isPolling() const { return fd == -1; }
+
+private:
+    path dir;
+    std::chrono::milliseconds poll_interval;
+    std::chrono::steady_clock::time_point last_poll;
+    // polling snapshot
+    std::unordered_map<std::string, fs::file_time_type> files;
+    // inotify descriptor and watched directories
+    int fd = -1;
+    std::unordered_map<int, path> watches;
+
+    void addWatches(const path &d);
+    void readEvents(std::vector<path> &changes);
+    void scan(std::vector<path> *changes);
+};
+
+} // namespace polygon4
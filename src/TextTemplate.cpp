@@ -0,0 +1,78 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Polygon4/TextTemplate.h>
+
+#include <algorithm>
+#include <string>
+#include <wctype.h>
+
+namespace polygon4
+{
+
+void TextTemplate::compile(const String &source, std::span<const Token> tokens)
+{
+    literals.clear();
+    segments.clear();
+
+    std::wstring_view s(source.data(), source.size());
+    while (!s.empty() && iswspace(s.back()))
+        s.remove_suffix(1);
+    if (s.empty())
+        return;
+
+    // first characters of all tokens
+    std::wstring starts;
+    for (auto &t : tokens)
+    {
+        if (!t.pattern.empty() && starts.find(t.pattern[0]) == starts.npos)
+            starts += t.pattern[0];
+    }
+
+    size_t run = 0;
+    for (size_t i = 0; i < s.size();)
+    {
+        auto p = s.find_first_of(starts, i);
+        literals.append(s.data() + i, (p == s.npos ? s.size() : p) - i);
+        if (p == s.npos)
+            break;
+        i = p;
+
+        auto t = std::find_if(tokens.begin(), tokens.end(), [v = s.substr(p)](const auto &t)
+        {
+            return !t.pattern.empty() && v.starts_with(t.pattern);
+        });
+        if (t == tokens.end())
+        {
+            literals += s[i++];
+            continue;
+        }
+        i += t->pattern.size();
+        if (t->slot < 0)
+        {
+            literals.append(t->text.data(), t->text.size());
+            continue;
+        }
+        segments.push_back({ (uint32_t)run, (uint32_t)(literals.size() - run), t->slot });
+        run = literals.size();
+    }
+    segments.push_back({ (uint32_t)run, (uint32_t)(literals.size() - run), -1 });
+}
+
+} // namespace polygon4
@@ -0,0 +1,47 @@
+#include "../ScriptBytecode.h"
+
+#include <lua.hpp>
+
+#include <filesystem>
+#include <stdio.h>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        printf("Usage: %s mod_dir\n", argv[0]);
+        printf("Precompiles mod_dir/Scripts into mod_dir/Cache/Bytecode\n");
+        return 1;
+    }
+
+    fs::path mod = argv[1];
+    auto scripts = mod / "Scripts";
+    if (!fs::is_directory(scripts))
+    {
+        printf("No scripts directory: %s\n", scripts.string().c_str());
+        return 1;
+    }
+
+    polygon4::LuaBytecodeCache cache(mod / "Cache" / "Bytecode");
+    auto L = luaL_newstate();
+
+    int n = 0, errors = 0;
+    for (auto &f : fs::recursive_directory_iterator(scripts))
+    {
+        if (!fs::is_regular_file(f) || f.path().extension() != ".lua")
+            continue;
+        if (cache.compile(L, f.path()))
+            n++;
+        else
+        {
+            printf("Cannot compile: %s\n", f.path().string().c_str());
+            errors++;
+        }
+    }
+    lua_close(L);
+
+    printf("Compiled %d scripts, %d errors\n", n, errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Polygon-4 Engine
+ * Copyright (C) 2015 lzwdgc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Polygon4/ObjectStreamer.h>
+
+#include <set>
+#include <stdio.h>
+
+using namespace polygon4;
+
+struct Object
+{
+    float x = 0.0f;
+    float y = 0.0f;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int frame)
+{
+    if (ok)
+        return;
+    printf("%s: frame %d\n", what, frame);
+    failures++;
+}
+
+// world side of the streamer
+struct World
+{
+    std::set<const Object *> spawned;
+    bool allow_despawn = true;
+
+    void attach(ObjectStreamer<Object> &s)
+    {
+        s.Spawn = [this](Object *o)
+        {
+            if (!spawned.insert(o).second)
+                failures++, printf("object spawned twice\n");
+        };
+        s.Despawn = [this](Object *o)
+        {
+            if (!allow_despawn)
+                return false;
+            spawned.erase(o);
+            return true;
+        };
+    }
+};
+
+static float distance2(const Object &o, float x, float y)
+{
+    return (o.x - x) * (o.x - x) + (o.y - y) * (o.y - y);
+}
+
+int main()
+{
+    EngineSettings::Streaming ss;
+    ss.enabled = true;
+    ss.spawn_radius = 1000.0f;
+    ss.despawn_radius = 1500.0f;
+    ss.spawn_budget = 16;
+    ss.update_distance = 100.0f;
+
+    // 100x100 grid with step 50, the spawn circle holds ~1250 objects
+    std::vector<Object> objects;
+    for (int i = 0; i < 100; i++)
+        for (int j = 0; j < 100; j++)
+            objects.push_back({ i * 50.0f, j * 50.0f });
+
+    ObjectStreamer<Object> s;
+    World w;
+    w.attach(s);
+    s.reset(ss.spawn_radius);
+    for (auto &o : objects)
+        s.add(&o, o.x, o.y);
+
+    size_t in_radius = 0;
+    float px = 2500.0f, py = 2500.0f;
+    for (auto &o : objects)
+        in_radius += distance2(o, px, py) <= ss.spawn_radius * ss.spawn_radius;
+    check(in_radius > (size_t)ss.spawn_budget * 10, "map is larger than the budget", 0);
+
+    // standing player, the ring fills in over several frames
+    int frame = 0;
+    size_t last = 0;
+    for (; frame < 1000 && (frame == 0 || s.isPending()); frame++)
+    {
+        s.update(px, py, ss);
+        check(w.spawned.size() - last <= (size_t)ss.spawn_budget, "spawn budget", frame);
+        // nearest first
+        for (auto &o : objects)
+        {
+            if (w.spawned.count(&o))
+                continue;
+            for (auto p : w.spawned)
+            {
+                if (distance2(o, px, py) < distance2(*p, px, py))
+                {
+                    check(false, "spawn order", frame);
+                    break;
+                }
+            }
+            break;
+        }
+        last = w.spawned.size();
+    }
+    auto frames = (in_radius + ss.spawn_budget - 1) / ss.spawn_budget;
+    check(frame == (int)frames, "frames to fill the ring", frame);
+    check(w.spawned.size() == in_radius, "ring is filled", frame);
+    check(s.spawnedCount() == in_radius, "spawned count", frame);
+    for (auto p : w.spawned)
+        check(distance2(*p, px, py) <= ss.spawn_radius * ss.spawn_radius, "spawned outside spawn radius", frame);
+
+    // nothing to do while the player stands still
+    s.update(px, py, ss);
+    check(w.spawned.size() == in_radius, "idle frame", frame++);
+
+    // a move shorter than update_distance does not despawn
+    px += 50.0f;
+    s.update(px, py, ss);
+    check(w.spawned.size() == in_radius, "small move", frame++);
+
+    // move away, objects between spawn and despawn radius stay
+    px += 400.0f;
+    s.update(px, py, ss);
+    for (int i = 0; i < 1000 && s.isPending(); i++)
+        s.update(px, py, ss);
+    auto r2 = ss.despawn_radius * ss.despawn_radius;
+    size_t kept = 0;
+    for (auto p : w.spawned)
+    {
+        check(distance2(*p, px, py) <= r2, "kept outside despawn radius", frame);
+        kept += distance2(*p, px, py) > ss.spawn_radius * ss.spawn_radius;
+    }
+    check(kept > 0, "hysteresis keeps objects between the radii", frame);
+    for (auto &o : objects)
+    {
+        if (distance2(o, px, py) <= ss.spawn_radius * ss.spawn_radius)
+            check(w.spawned.count(&o) > 0, "ring is filled after a move", frame);
+    }
+    frame++;
+
+    // far move despawns everything of the old ring
+    px += 2000.0f;
+    s.update(px, py, ss);
+    for (auto p : w.spawned)
+        check(distance2(*p, px, py) <= r2, "despawned after a far move", frame);
+    check(w.spawned.size() == s.spawnedCount(), "spawned count after despawn", frame);
+    frame++;
+
+    // objects the game keeps are not despawned
+    w.allow_despawn = false;
+    auto n = w.spawned.size();
+    px -= 4000.0f;
+    s.update(px, py, ss);
+    check(s.spawnedCount() >= n && w.spawned.size() == s.spawnedCount(), "despawn refused", frame);
+
+    if (failures)
+    {
+        printf("failures: %d\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <Polygon4/ScreenTextBuffer.h>
+
+#include <random>
+#include <stdio.h>
+
+using namespace polygon4;
+
+// ui side of the sync recipe from ScreenTextBuffer.h
+struct Ui
+{
+    String text;
+    uint64_t version = 0;
+
+    void sync(const ScreenTextBuffer &b)
+    {
+        auto d = b.getDelta(version);
+        if (d.keep > text.size())
+            d.keep = text.size() + 1; // marks the error, checked by the caller
+        text.resize(d.keep);
+        text += d.appended;
+        version = d.version;
+    }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int run, int op)
+{
+    if (ok)
+        return;
+    printf("%s: run %d, op %d\n", what, run, op);
+    failures++;
+}
+
+static void append(ScreenTextBuffer &b, String &ref, const String &s)
+{
+    b.append(s);
+    ref += s;
+}
+
+// clear and re-render sequences as done by BuildingMenu::refreshText()
+static void test_multi_clear()
+{
+    ScreenTextBuffer b;
+    String ref;
+    Ui ui;
+
+    append(b, ref, L"A");
+    append(b, ref, L"B");
+    ui.sync(b);
+    b.clear();
+    ref.clear();
+    append(b, ref, L"A");
+    ui.sync(b);
+    check(ui.text == ref, "clear, partial re-render", 0, 0);
+    b.clear();
+    ref.clear();
+    append(b, ref, L"A");
+    append(b, ref, L"B");
+    ui.sync(b);
+    check(ui.text == ref, "clear twice, full re-render", 0, 1);
+
+    // unchanged text gives an empty delta
+    auto v = b.getVersion();
+    b.clear();
+    append(b, ref = {}, L"A");
+    append(b, ref, L"B");
+    auto d = b.getDelta(v);
+    check(d.keep == 2 && d.appended.empty(), "unchanged re-render", 0, 2);
+
+    // several clears without a sync in between
+    ui.sync(b);
+    for (int i = 0; i < 3; i++)
+    {
+        b.clear();
+        ref.clear();
+        append(b, ref, L"A");
+    }
+    append(b, ref, L"C");
+    ui.sync(b);
+    check(ui.text == ref, "clears without sync", 0, 3);
+}
+
+static void test_random()
+{
+    const String words[] = { L"a", L"bb", L"ccc", L"dd\n", L"e" };
+    std::mt19937 rng(42);
+
+    for (int run = 1; run <= 500; run++)
+    {
+        ScreenTextBuffer b, saved;
+        String ref;
+        Ui ui;
+        for (int op = 0; op < 300; op++)
+        {
+            switch (rng() % 10)
+            {
+            case 0: case 1: case 2: case 3: case 4:
+                append(b, ref, words[rng() % std::size(words)]);
+                break;
+            case 5: case 6:
+                b.clear();
+                ref.clear();
+                break;
+            case 7:
+                ui.sync(b);
+                check(ui.text == ref, "delta", run, op);
+                break;
+            case 8:
+                if (rng() % 2)
+                    saved.assign(b);
+                else
+                {
+                    b.assign(saved);
+                    ref = saved.str();
+                }
+                break;
+            case 9:
+            {
+                check(b.str() == ref && b.size() == ref.size(), "str", run, op);
+                auto &w = words[rng() % std::size(words)];
+                auto ends = ref.size() >= w.size() && ref.compare(ref.size() - w.size(), w.size(), w) == 0;
+                check(b.endsWith(w) == ends, "endsWith", run, op);
+                break;
+            }
+            }
+        }
+    }
+}
+
+int main()
+{
+    test_multi_clear();
+    test_random();
+    if (failures)
+    {
+        printf("failures: %d\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <Polygon4/BuildingMenu.h>
+#include <Polygon4/Engine.h>
+#include <Polygon4/Modification.h>
+
+#include <Polygon4/DataManager/Storage.h>
+
+#include "Script.h"
+#include "ScriptLuaCompat.h"
+
+#include <tools/Logger.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+// built twice, against the lua and luajit engines, run both on the same script to compare backends
+// the script is loaded by the script engine of the modification and calls the real api
+
+using namespace polygon4;
+
+using Clock = std::chrono::high_resolution_clock;
+
+// engine without the game side, menus are never shown
+class BenchmarkEngine : public Engine
+{
+    struct Menu : BuildingMenu
+    {
+        virtual void refresh() override {}
+    };
+
+public:
+    BenchmarkEngine(const String &gameDirectory)
+        : Engine(gameDirectory)
+    {
+    }
+
+    virtual void initChildren() override {}
+
+    virtual BuildingMenu *getBuildingMenu() override { return &menu; }
+    virtual void DestroyBuildingMenu() override {}
+
+    virtual void ShowMainMenu() override {}
+    virtual void HideMainMenu() override {}
+    virtual void SetMainMenuVisibility(bool) override {}
+    virtual void ShowBuildingMenu() override {}
+    virtual void HideBuildingMenu() override {}
+    virtual void SetBuildingMenuVisibility(bool) override {}
+    virtual void ShowPauseMenu() override {}
+    virtual void HidePauseMenu() override {}
+    virtual void SetPauseMenuVisibility(bool) override {}
+
+    virtual void OnLevelLoaded() override {}
+
+private:
+    Menu menu;
+};
+
+// scripts are started without loading a level
+class BenchmarkModification : public Modification
+{
+public:
+    using Modification::Modification;
+
+    ScriptEngine &startScripts()
+    {
+        scriptEngine = std::make_unique<ScriptEngine>(path(getEngine()->getSettings().dirs.mods.c_str()) / directory.c_str(), script_language, this);
+        return *scriptEngine;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        printf("Usage: %s game_dir modification script [iterations]\n", argv[0]);
+        printf("Loads script from <mods>/<modification>/Scripts, e.g. maps/<map>/<building>,\n");
+        printf("and calls its OnEnterBuilding() iterations times on behalf of the local player\n");
+        return 1;
+    }
+
+    LOGGER_CONFIGURE("INFO", "");
+
+    std::string script = argv[3];
+    int iterations = argc > 4 ? atoi(argv[4]) : 10000;
+
+    BenchmarkEngine engine(String(std::string(argv[1])));
+    getEngine(&engine);
+    if (!engine.getStorage())
+    {
+        printf("Cannot load game data from %s\n", argv[1]);
+        return 1;
+    }
+
+    auto mods = engine.getStorage()->modifications.get_key_map(&detail::Modification::directory);
+    auto mi = mods.find(String(std::string(argv[2])));
+    if (mi == mods.end())
+    {
+        printf("No such modification: %s\n", argv[2]);
+        return 1;
+    }
+    BenchmarkModification mod(*(detail::Modification *)mi->second);
+
+    detail::ModificationPlayer *player = nullptr;
+    for (auto &p : mod.players)
+    {
+        if (p->player == mod.player)
+        {
+            player = p;
+            break;
+        }
+    }
+    if (!player)
+    {
+        printf("No local player in the modification\n");
+        return 1;
+    }
+
+    detail::ModificationMapBuilding *building = nullptr;
+    for (auto &m : mod.maps)
+    {
+        for (auto &b : m->buildings)
+        {
+            if (ScriptEngine::getBuildingScriptName(b) == script)
+                building = b;
+        }
+    }
+    if (!building)
+    {
+        printf("No building uses script: %s\n", script.c_str());
+        return 1;
+    }
+
+    engine.setCurrentModification(&mod);
+
+    auto start = Clock::now();
+    auto &se = mod.startScripts();
+    auto s = se.getScript(script);
+    auto load = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    s->data.script = s;
+    s->data.player = player;
+    s->data.building = building;
+    auto bm = engine.getBuildingMenu();
+    bm->setCurrentBuilding(building);
+    s->RegisterQuests();
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        bm->clearText();
+        s->OnEnterBuilding();
+    }
+    auto total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    auto calls = se.getCallStats();
+    auto memory = se.getMemoryStats();
+
+#ifdef LUAJIT_VERSION
+    printf("backend: %s\n", LUAJIT_VERSION);
+#else
+    printf("backend: %s\n", LUA_RELEASE);
+#endif
+    printf("load:            %10.2f ms\n", load);
+    printf("OnEnterBuilding: %10.2f us/call (%d calls, %llu errors)\n", total * 1000 / iterations, iterations,
+        (unsigned long long)calls.errors);
+    printf("memory:          %10zu kb (peak %zu kb)\n", memory.used / 1024, memory.peak / 1024);
+
+    // generic and fast binding paths, logged
+    se.benchmarkBindings(player, iterations);
+
+    engine.setCurrentModification(nullptr);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "../ScriptTrace.h"
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace polygon4;
+
+struct Summary
+{
+    size_t calls = 0;
+    size_t failed = 0;
+    size_t queries = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s trace.p4trace [calls]\n", argv[0]);
+        printf("prints recorded time per script function, with 'calls' also every call\n");
+        printf("traces are replayed in the game with Engine::replayScriptTrace()\n");
+        return 1;
+    }
+
+    try
+    {
+        ScriptTraceReader r(argv[1]);
+        bool print_calls = argc > 2 && strcmp(argv[2], "calls") == 0;
+
+        printf("snapshot: %s\n", r.getSnapshot().c_str());
+        std::map<std::string, Summary> functions;
+        for (auto &c : r.getCalls())
+        {
+            if (print_calls)
+            {
+                printf("%*s%s:%s player = %lld, building = %s, args = %zu, queries = %zu, %.2f us%s\n",
+                    c.depth * 4, "", c.script.c_str(), c.function.c_str(), (long long)c.player,
+                    c.building.c_str(), c.args.size(), c.queries.size(), c.time_ns / 1000.0, c.ok ? "" : ", failed");
+            }
+            auto &s = functions[c.script + ":" + c.function];
+            s.calls++;
+            s.failed += !c.ok;
+            s.queries += c.queries.size();
+            s.total_ns += c.time_ns;
+            s.max_ns = std::max(s.max_ns, c.time_ns);
+        }
+
+        std::vector<std::pair<std::string, Summary>> sorted(functions.begin(), functions.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second.total_ns > b.second.total_ns; });
+        printf("%10s %10s %12s %12s %12s %8s  %s\n", "calls", "failed", "total ms", "avg us", "max us", "queries", "function");
+        for (auto &[name, s] : sorted)
+        {
+            printf("%10zu %10zu %12.3f %12.2f %12.2f %8zu  %s\n", s.calls, s.failed, s.total_ns / 1e6,
+                s.total_ns / 1000.0 / s.calls, s.max_ns / 1000.0, s.queries, name.c_str());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        printf("%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
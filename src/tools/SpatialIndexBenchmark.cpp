@@ -0,0 +1,138 @@
+#include <Polygon4/SpatialIndex.h>
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace polygon4;
+
+struct Object
+{
+    float x;
+    float y;
+};
+
+using Clock = std::chrono::high_resolution_clock;
+
+template <class F>
+double measure(int iterations, F &&f)
+{
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+        f(i);
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    int n_objects = argc > 1 ? atoi(argv[1]) : 20000;
+    float map_size = argc > 2 ? (float)atof(argv[2]) : 1000000.0f;
+    float cell_size = argc > 3 ? (float)atof(argv[3]) : 10000.0f;
+    const int n_queries = 2000;
+    const float radius = 20000.0f;
+    const size_t k = 8;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coord(0, map_size);
+
+    std::vector<Object> objects(n_objects);
+    for (auto &o : objects)
+        o = { coord(rng), coord(rng) };
+
+    std::vector<Object> points(n_queries);
+    for (auto &p : points)
+        p = { coord(rng), coord(rng) };
+
+    SpatialIndex<Object> index(cell_size);
+    auto build = measure(1, [&](int)
+    {
+        for (auto &o : objects)
+            index.insert(&o, o.x, o.y);
+    });
+
+    size_t hits_grid = 0, hits_scan = 0;
+
+    // radius
+    auto radius_grid = measure(n_queries, [&](int i)
+    {
+        hits_grid += index.queryRadius(points[i].x, points[i].y, radius).size();
+    });
+    auto radius_scan = measure(n_queries, [&](int i)
+    {
+        std::vector<Object *> v;
+        for (auto &o : objects)
+        {
+            auto dx = o.x - points[i].x;
+            auto dy = o.y - points[i].y;
+            if (dx * dx + dy * dy <= radius * radius)
+                v.push_back(&o);
+        }
+        hits_scan += v.size();
+    });
+    if (hits_grid != hits_scan)
+    {
+        printf("radius query mismatch: %zu != %zu\n", hits_grid, hits_scan);
+        return 1;
+    }
+
+    // k nearest
+    std::vector<Object *> nearest(n_queries);
+    size_t found = 0;
+    auto nearest_grid = measure(n_queries, [&](int i)
+    {
+        found += index.queryNearest(points[i].x, points[i].y, k).size();
+    });
+    if (found != n_queries * std::min(k, objects.size()))
+    {
+        printf("nearest query found %zu objects\n", found);
+        return 1;
+    }
+    auto nearest_scan = measure(n_queries, [&](int i)
+    {
+        std::vector<std::pair<float, Object *>> v;
+        v.reserve(objects.size());
+        for (auto &o : objects)
+        {
+            auto dx = o.x - points[i].x;
+            auto dy = o.y - points[i].y;
+            v.emplace_back(dx * dx + dy * dy, &o);
+        }
+        auto n = std::min(k, v.size());
+        std::partial_sort(v.begin(), v.begin() + n, v.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+        nearest[i] = v[0].second;
+    });
+    size_t mismatches = 0;
+    for (int i = 0; i < n_queries; i++)
+    {
+        if (index.queryNearest(points[i].x, points[i].y) != nearest[i])
+            mismatches++;
+    }
+    if (mismatches)
+    {
+        printf("nearest query mismatches: %zu\n", mismatches);
+        return 1;
+    }
+
+    // moving objects
+    std::uniform_real_distribution<float> step(-500.0f, 500.0f);
+    auto update = measure(n_objects, [&](int i)
+    {
+        auto &o = objects[i];
+        o.x += step(rng);
+        o.y += step(rng);
+        index.update(&o, o.x, o.y);
+    });
+
+    printf("objects: %d, map size: %.0f, cell size: %.0f\n", n_objects, map_size, cell_size);
+    printf("build:             %10.2f us\n", build);
+    printf("radius   grid:     %10.2f us/query\n", radius_grid);
+    printf("radius   scan:     %10.2f us/query\n", radius_scan);
+    printf("nearest  grid:     %10.2f us/query (k = %zu)\n", nearest_grid, k);
+    printf("nearest  scan:     %10.2f us/query (k = %zu)\n", nearest_scan, k);
+    printf("update:            %10.2f us/object\n", update);
+
+    return 0;
+}
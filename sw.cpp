@@ -5,6 +5,10 @@ void build(Solution &s)
 
     auto cppstd = cpp23;
 
+    // scripts backend, luajit provides lua 5.1 api plus ffi
+    // both libraries export the same symbols, so an engine is built against one of them
+    auto lua = [](bool luajit) { return luajit ? "org.sw.demo.LuaJIT"_dep : "org.sw.demo.lua"_dep; };
+
     auto &logger = Engine.addStaticLibrary("logger");
     {
         logger += cppstd;
@@ -15,30 +19,31 @@ void build(Solution &s)
         logger.Public += "USE_LOGGER"_def;
     }
 
+    auto setup_engine = [&](auto &e, bool luajit)
     {
-        Engine.ApiName = "P4_ENGINE_API";
-        Engine += cppstd;
-        Engine += "include/Polygon4/.*"_rr;
-        Engine += "src/.*"_r;
-        if (Engine.getBuildSettings().TargetOS.is(OSType::Windows))
-            Engine += "src/tools/Hotpatch.*"_rr;
+        e.ApiName = "P4_ENGINE_API";
+        e += cppstd;
+        e += "include/Polygon4/.*"_rr;
+        e += "src/.*"_r;
+        if (e.getBuildSettings().TargetOS.is(OSType::Windows))
+            e += "src/tools/Hotpatch.*"_rr;
 
-        auto d = Engine.Public + "pub.lzwdgc.polygon4.datamanager.memory-master"_dep;
+        auto d = e.Public + "pub.lzwdgc.polygon4.datamanager.memory-master"_dep;
         //d->getOptions()["alligned-allocator"] = "1";
         //d->getOptions()["alligned-allocator"].setRequired();
 
-        Engine.Public += logger,
+        e.Public += logger,
             "pub.egorpugin.primitives.executor"_dep,
             "pub.egorpugin.primitives.command"_dep,
             "pub.lzwdgc.polygon4.datamanager-master"_dep,
-            "org.sw.demo.lua"_dep
+            lua(luajit)
             ;
-        if (Engine.getBuildSettings().TargetOS.is(OSType::Windows))
-            Engine += "dbghelp.lib"_slib;
+        if (e.getBuildSettings().TargetOS.is(OSType::Windows))
+            e += "dbghelp.lib"_slib;
 
         {
             String prefix = "ScriptAPI";
-            auto c = Engine.addCommand();
+            auto c = e.addCommand();
             c << cmd::prog("org.sw.demo.swig"_dep)
                 << "-c++"
                 << "-lua"
@@ -47,7 +52,12 @@ void build(Solution &s)
                 << cmd::in("src/" + prefix + ".i")
                 ;
         }
-    }
+    };
+    setup_engine(Engine, false);
+
+    // same engine against luajit, keeps the 5.1 compat code and ffi bindings building
+    auto &EngineJit = s.addLibrary("Polygon4.Engine.LuaJIT", "master");
+    setup_engine(EngineJit, true);
 
     auto &pdbfix = Engine.addExecutable("tools.pdbfix");
     {
@@ -64,6 +74,73 @@ void build(Solution &s)
     fixproject.PackageDefinitions = true;
     fixproject += "src/tools/FixProject.cpp";
 
+    auto &compile_scripts = Engine.addExecutable("tools.compile_scripts");
+    {
+        compile_scripts.PackageDefinitions = true;
+        compile_scripts += cppstd;
+        compile_scripts += "src/tools/CompileScripts.cpp";
+        compile_scripts += "src/ScriptBytecode.*"_rr;
+        compile_scripts += IncludeDirectory("src");
+        compile_scripts += logger;
+        compile_scripts += lua(false);
+    }
+
+    // same source against both engines
+    auto &script_benchmark = Engine.addExecutable("tools.script_benchmark");
+    {
+        script_benchmark.PackageDefinitions = true;
+        script_benchmark += cppstd;
+        script_benchmark += "src/tools/ScriptBenchmark.cpp";
+        script_benchmark += IncludeDirectory("src");
+        script_benchmark += Engine;
+    }
+
+    auto &script_benchmark_jit = Engine.addExecutable("tools.script_benchmark_jit");
+    {
+        script_benchmark_jit.PackageDefinitions = true;
+        script_benchmark_jit += cppstd;
+        script_benchmark_jit += "src/tools/ScriptBenchmark.cpp";
+        script_benchmark_jit += IncludeDirectory("src");
+        script_benchmark_jit += EngineJit;
+    }
+
+    // prints recorded script call traces
+    auto &script_trace = Engine.addExecutable("tools.script_trace");
+    {
+        script_trace.PackageDefinitions = true;
+        script_trace += cppstd;
+        script_trace += "src/tools/ScriptTrace.cpp";
+        script_trace += "src/ScriptTrace.cpp";
+        script_trace += IncludeDirectory("src");
+        script_trace += "pub.egorpugin.primitives.filesystem"_dep;
+    }
+
+    auto &spatial_index_benchmark = Engine.addExecutable("tools.spatial_index_benchmark");
+    {
+        spatial_index_benchmark.PackageDefinitions = true;
+        spatial_index_benchmark += cppstd;
+        spatial_index_benchmark += "src/tools/SpatialIndexBenchmark.cpp";
+        spatial_index_benchmark += IncludeDirectory("include");
+    }
+
+    // checks ui sync of the screen text buffer
+    auto &screen_text_buffer_test = Engine.addExecutable("tools.screen_text_buffer_test");
+    {
+        screen_text_buffer_test.PackageDefinitions = true;
+        screen_text_buffer_test += cppstd;
+        screen_text_buffer_test += "src/tools/ScreenTextBufferTest.cpp";
+        screen_text_buffer_test += Engine;
+    }
+
+    // checks map object streaming over several frames
+    auto &object_streamer_test = Engine.addExecutable("tools.object_streamer_test");
+    {
+        object_streamer_test.PackageDefinitions = true;
+        object_streamer_test += cppstd;
+        object_streamer_test += "src/tools/ObjectStreamerTest.cpp";
+        object_streamer_test += IncludeDirectory("include");
+    }
+
     auto &prepare_sw_info = Engine.addExecutable("tools.prepare_sw_info", "0.0.1");
     {
         prepare_sw_info.PackageDefinitions = true;